@@ -12,6 +12,7 @@ The following import targets are created
   cppgraphqlgen::graphqlpeg
   cppgraphqlgen::graphqlservice
   cppgraphqlgen::graphqljson
+  cppgraphqlgen::graphqlbinary
   cppgraphqlgen::schemagen
 #]=======================================================================]
 
@@ -171,6 +171,8 @@ struct OutputField
 	TypeModifierStack modifiers;
 	std::string description;
 	std::optional<std::string> deprecationReason;
+	std::optional<std::string> cacheControlMaxAge;
+	std::optional<int> cacheMaxAge;
 	std::optional<tao::graphqlpeg::position> position;
 	bool interfaceField = false;
 	bool inheritedField = false;
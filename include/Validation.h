@@ -9,6 +9,8 @@
 #include "graphqlservice/GraphQLService.h"
 #include "graphqlservice/IntrospectionSchema.h"
 
+#include <limits>
+
 namespace graphql::service {
 
 using ValidateType = response::Value;
@@ -163,7 +165,8 @@ private:
 class ValidateExecutableVisitor
 {
 public:
-	ValidateExecutableVisitor(const Request& service);
+	ValidateExecutableVisitor(const Request& service,
+		size_t maxErrors = std::numeric_limits<size_t>::max());
 
 	void visit(const peg::ast_node& root);
 
@@ -172,6 +175,13 @@ public:
 private:
 	response::Value executeQuery(std::string_view query) const;
 
+	// Once we have collected as many errors as the caller asked for, skip the rest of the rules.
+	bool hasMaxErrors() const noexcept;
+
+	// Count each selection as it is expanded, and report an error the first time the total for the
+	// current operation or fragment definition exceeds Request::getMaxSelections.
+	bool countSelection(const peg::ast_node& selection);
+
 	static ValidateTypeFieldArguments getArguments(response::ListType&& argumentsMember);
 
 	using FieldTypes = std::map<std::string, ValidateTypeField>;
@@ -214,6 +224,8 @@ private:
 		const schema_location& position, const ValidateType& inputType);
 
 	const Request& _service;
+	const size_t _maxErrors;
+	const size_t _maxSelections;
 	std::vector<schema_error> _errors;
 
 	using OperationTypes = std::map<std::string_view, std::string>;
@@ -244,6 +256,7 @@ private:
 	FragmentSet _fragmentStack;
 	FragmentSet _fragmentCycles;
 	size_t _fieldCount = 0;
+	size_t _selectionCount = 0;
 	TypeFields _typeFields;
 	InputTypeFields _inputTypeFields;
 	std::string _scopedType;
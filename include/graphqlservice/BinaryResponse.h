@@ -0,0 +1,53 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#pragma once
+
+#ifndef BINARYRESPONSE_H
+#define BINARYRESPONSE_H
+
+// clang-format off
+#ifdef GRAPHQL_DLLEXPORTS
+	#ifdef IMPL_BINARYRESPONSE_DLL
+		#define BINARYRESPONSE_EXPORT __declspec(dllexport)
+	#else // !IMPL_BINARYRESPONSE_DLL
+		#define BINARYRESPONSE_EXPORT __declspec(dllimport)
+	#endif // !IMPL_BINARYRESPONSE_DLL
+#else // !GRAPHQL_DLLEXPORTS
+	#define BINARYRESPONSE_EXPORT
+#endif // !GRAPHQL_DLLEXPORTS
+// clang-format on
+
+#include "graphqlservice/GraphQLResponse.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace graphql::response {
+
+// Binary encodings which preserve every response::Type, so a Value survives a round trip between
+// services exactly. JSON can't distinguish Type::EnumValue from Type::String, or a Type::Scalar
+// from the Value it contains, so both encodings mark them with an application-specific tag.
+//
+// IdType values are stored as Base64 strings in a Value, so they are encoded as strings. Binary
+// data from other encoders (CBOR byte strings or MessagePack bin) is decoded as a Base64 string
+// which matches the way IdType is represented in a Value.
+
+// CBOR (RFC 7049) tags for the types which do not have a native encoding.
+constexpr uint64_t cborEnumValueTag = 18257;
+constexpr uint64_t cborScalarTag = 18258;
+
+BINARYRESPONSE_EXPORT std::vector<uint8_t> toCBOR(const Value& response);
+BINARYRESPONSE_EXPORT Value fromCBOR(const std::vector<uint8_t>& cbor);
+
+// MessagePack extension types for the types which do not have a native encoding. The payload of
+// a Scalar extension is the MessagePack encoding of the Value it contains.
+constexpr int8_t messagePackEnumValueType = 1;
+constexpr int8_t messagePackScalarType = 2;
+
+BINARYRESPONSE_EXPORT std::vector<uint8_t> toMessagePack(const Value& response);
+BINARYRESPONSE_EXPORT Value fromMessagePack(const std::vector<uint8_t>& messagePack);
+
+} /* namespace graphql::response */
+
+#endif // BINARYRESPONSE_H
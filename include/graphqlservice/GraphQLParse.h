@@ -18,6 +18,7 @@
 #endif // !GRAPHQL_DLLEXPORTS
 // clang-format on
 
+#include <atomic>
 #include <memory>
 #include <string_view>
 
@@ -27,11 +28,49 @@ namespace peg {
 struct ast_node;
 struct ast_input;
 
+// The same parsed document may be validated and resolved by several threads at once, so the
+// validated flag is atomic. Copying or moving an ast copies the current value of the flag.
+class ast_validated
+{
+public:
+	ast_validated(bool validated = false) noexcept
+		: _validated(validated)
+	{
+	}
+
+	ast_validated(const ast_validated& other) noexcept
+		: _validated(static_cast<bool>(other))
+	{
+	}
+
+	ast_validated& operator=(const ast_validated& rhs) noexcept
+	{
+		return *this = static_cast<bool>(rhs);
+	}
+
+	ast_validated& operator=(bool validated) noexcept
+	{
+		_validated.store(validated, std::memory_order_release);
+		return *this;
+	}
+
+	operator bool() const noexcept
+	{
+		return _validated.load(std::memory_order_acquire);
+	}
+
+private:
+	std::atomic_bool _validated;
+};
+
 struct ast
 {
 	std::shared_ptr<ast_input> input;
 	std::shared_ptr<ast_node> root;
-	bool validated = false;
+
+	// Validation only ever changes this from false to true, and it may do that through a const
+	// reference to the ast.
+	mutable ast_validated validated;
 };
 
 GRAPHQLPEG_EXPORT ast parseString(std::string_view input);
@@ -19,8 +19,10 @@
 // clang-format on
 
 #include <memory>
+#include <memory_resource>
 #include <string>
 #include <unordered_map>
+#include <variant>
 #include <vector>
 
 namespace graphql::response {
@@ -109,7 +111,63 @@ struct ValueTypeTraits<IdType>
 	// ID values are represented as a String, there's no separate handling of this type.
 };
 
-struct TypedData;
+struct MapData;
+struct ListData;
+struct ScalarData;
+
+// Map, List, and Scalar values are allocated from the std::pmr::memory_resource which was current
+// when they were created, and they are returned to the same memory_resource when they are freed.
+struct NodeDeleter
+{
+	void operator()(MapData* data) const noexcept;
+	void operator()(ListData* data) const noexcept;
+	void operator()(ScalarData* data) const noexcept;
+};
+
+// While this is in scope, the nodes for any Map, List, or Scalar values created on the current
+// thread are allocated from the specified memory_resource instead of
+// std::pmr::get_default_resource(). The std::vector and std::string members inside of those nodes
+// still use std::allocator, and values created on other threads, e.g. by resolvers running with
+// std::launch::async, are not affected. The memory_resource must outlive every Value allocated
+// from it.
+class MemoryResourceScope
+{
+public:
+	GRAPHQLRESPONSE_EXPORT explicit MemoryResourceScope(
+		std::pmr::memory_resource* resource) noexcept;
+	GRAPHQLRESPONSE_EXPORT ~MemoryResourceScope();
+
+	MemoryResourceScope(const MemoryResourceScope&) = delete;
+	MemoryResourceScope& operator=(const MemoryResourceScope&) = delete;
+
+	GRAPHQLRESPONSE_EXPORT static std::pmr::memory_resource* current() noexcept;
+
+private:
+	std::pmr::memory_resource* const _previous;
+};
+
+// Receive the contents of a Value from Value::visit in document order without modifying or
+// releasing anything, e.g. to serialize the same Value more than once. Scalar values are visited
+// as whatever type they contain.
+class ValueVisitor
+{
+public:
+	GRAPHQLRESPONSE_EXPORT virtual ~ValueVisitor();
+
+	virtual void startMap(size_t count) = 0;
+	virtual void addMember(const std::string& name) = 0;
+	virtual void endMap() = 0;
+
+	virtual void startList(size_t count) = 0;
+	virtual void endList() = 0;
+
+	virtual void addString(const StringType& value) = 0;
+	virtual void addEnum(const StringType& value) = 0;
+	virtual void addNull() = 0;
+	virtual void addBool(BooleanType value) = 0;
+	virtual void addInt(IntType value) = 0;
+	virtual void addFloat(FloatType value) = 0;
+};
 
 // Represent a discriminated union of GraphQL response value types.
 struct Value
@@ -156,6 +214,9 @@ struct Value
 	GRAPHQLRESPONSE_EXPORT void emplace_back(Value&& value);
 	GRAPHQLRESPONSE_EXPORT const Value& operator[](size_t index) const;
 
+	// Walk the whole Value, calling addMember before each member of a Map.
+	GRAPHQLRESPONSE_EXPORT void visit(ValueVisitor& visitor) const;
+
 	// Specialized for all single-value Types.
 	template <typename ValueType>
 	void set(typename std::enable_if_t<std::is_same_v<std::decay_t<ValueType>, ValueType>,
@@ -194,10 +255,29 @@ struct Value
 	}
 
 private:
+	// applyPatch modifies the members of a Map or List in place.
+	friend struct PatchOperation;
+
+	// Null, Boolean, Int, Float, String, and EnumValue are stored inline, and short strings can
+	// use the small string optimization. Map, List, and Scalar values are recursive, so they are
+	// allocated separately.
+	using TypedData = std::variant<std::monostate, BooleanType, IntType, FloatType, StringType,
+		std::unique_ptr<MapData, NodeDeleter>, std::unique_ptr<ListData, NodeDeleter>,
+		std::unique_ptr<ScalarData, NodeDeleter>>;
+
 	const Type _type;
-	std::unique_ptr<TypedData> _data;
+	bool _fromJson = false;
+	TypedData _data;
 };
 
+// Build a list of "add", "remove", and "replace" operations like a JSON Patch (RFC 6902), which
+// turns from into to. Map members are matched by name and List entries by index, and Scalar
+// values are always replaced as a whole.
+GRAPHQLRESPONSE_EXPORT Value makePatch(const Value& from, const Value& to);
+
+// Apply the operations from makePatch to document in order.
+GRAPHQLRESPONSE_EXPORT void applyPatch(Value& document, const Value& patch);
+
 #ifdef GRAPHQL_DLLEXPORTS
 // Export all of the specialized template methods
 template <>
@@ -21,18 +21,23 @@
 #include "graphqlservice/GraphQLParse.h"
 #include "graphqlservice/GraphQLResponse.h"
 
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <future>
+#include <limits>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <queue>
 #include <set>
+#include <shared_mutex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <type_traits>
 #include <tuple>
 #include <unordered_map>
@@ -99,6 +104,15 @@ private:
 // correlate the asynchronous/recursive callbacks and accumulate state in it.
 struct RequestState : std::enable_shared_from_this<RequestState>
 {
+	virtual ~RequestState() = default;
+
+	// Responses cached by Request::resolveCached are only shared between requests with the same
+	// scope. The default empty scope shares them with every request, so override this (e.g. with a
+	// user ID) if the response to the same query depends on who is asking.
+	virtual std::string getCacheScope() const
+	{
+		return {};
+	}
 };
 
 namespace {
@@ -112,6 +126,7 @@ constexpr std::string_view strLocations { "locations"sv };
 constexpr std::string_view strLine { "line"sv };
 constexpr std::string_view strColumn { "column"sv };
 constexpr std::string_view strPath { "path"sv };
+constexpr std::string_view strPatch { "patch"sv };
 constexpr std::string_view strQuery { "query"sv };
 constexpr std::string_view strMutation { "mutation"sv };
 constexpr std::string_view strSubscription { "subscription"sv };
@@ -139,6 +154,47 @@ enum class ResolverContext
 	NotifyUnsubscribe,
 };
 
+// Nested fragment spreads can make a small document expand into an exponential number of
+// selections. A single SelectionCounter is shared by every Object::resolve call in an operation,
+// and it counts each field, fragment spread, and inline fragment as it is expanded.
+class SelectionCounter
+{
+public:
+	GRAPHQLSERVICE_EXPORT explicit SelectionCounter(size_t maxSelections) noexcept;
+
+	// Returns false once the total number of expanded selections exceeds maxSelections.
+	GRAPHQLSERVICE_EXPORT bool increment() noexcept;
+
+	GRAPHQLSERVICE_EXPORT size_t getMaxSelections() const noexcept;
+
+private:
+	const size_t _maxSelections;
+	std::atomic_size_t _count { 0 };
+};
+
+// Fields annotated with @cacheControl(maxAge:) in the schema report their max-age in seconds to a
+// CacheControl shared by every Object::resolve call in an operation, and the response may be cached
+// for the minimum of those hints. Fields without a hint inherit it from their parent, but every
+// root field must have its own hint, or the response will not be cached at all.
+class CacheControl
+{
+public:
+	GRAPHQLSERVICE_EXPORT CacheControl() noexcept;
+
+	GRAPHQLSERVICE_EXPORT void hint(std::chrono::seconds maxAge, bool rootField) noexcept;
+	GRAPHQLSERVICE_EXPORT void addRootField() noexcept;
+
+	// Mutations and responses which should never be cached.
+	GRAPHQLSERVICE_EXPORT void disable() noexcept;
+
+	GRAPHQLSERVICE_EXPORT std::chrono::seconds getMaxAge() const noexcept;
+
+private:
+	std::atomic<std::chrono::seconds::rep> _maxAge;
+	std::atomic_size_t _rootFields { 0 };
+	std::atomic_size_t _hintedRootFields { 0 };
+};
+
 // Pass a common bundle of parameters to all of the generated Object::getField accessors in a
 // SelectionSet
 struct SelectionSetParams
@@ -163,6 +219,13 @@ struct SelectionSetParams
 
 	// Async launch policy for sub-field resolvers.
 	const std::launch launch = std::launch::deferred;
+
+	// Limit on the number of selections expanded for the entire operation, or nullptr if there is
+	// no limit.
+	const std::shared_ptr<SelectionCounter> selectionCounter {};
+
+	// Cache hints for the entire operation, or nullptr if the response will not be cached.
+	const std::shared_ptr<CacheControl> cacheControl {};
 };
 
 // Pass a common bundle of parameters to all of the generated Object::getField accessors.
@@ -239,6 +302,9 @@ struct ResolverParams : SelectionSetParams
 
 	GRAPHQLSERVICE_EXPORT schema_location getLocation() const;
 
+	// Called by the generated resolvers for fields with a @cacheControl(maxAge:) directive.
+	GRAPHQLSERVICE_EXPORT void hintCacheMaxAge(std::chrono::seconds maxAge) const noexcept;
+
 	// These values are different for each resolver.
 	const peg::ast_node& field;
 	std::string fieldName;
@@ -507,6 +573,9 @@ private:
 	ResolverMap _resolvers;
 };
 
+// Throw a schema_exception if a field with a leaf type has a selection set.
+GRAPHQLSERVICE_EXPORT void blockSubFields(const ResolverParams& params);
+
 // Convert the result of a resolver function with chained type modifiers that add nullable or
 // list wrappers. This is the inverse of ModifiedArgument for output types instead of input types.
 template <typename Type>
@@ -542,6 +611,33 @@ struct ModifiedResult
 	static std::future<response::Value> convert(
 		typename ResultTraits<Type>::future_type result, ResolverParams&& params);
 
+	// The built-in scalar types can't fail to convert and they don't have any sub-fields, so a
+	// list of them can be converted directly instead of with a separate std::future per element.
+	// Lists of enums, custom scalars, and objects still resolve each element separately, since
+	// those conversions can fail or run more resolvers, and each failure needs its own error path.
+	template <TypeModifier... Other>
+	static constexpr bool is_builtin_list_element = (std::is_same_v<response::IntType, Type>
+		|| std::is_same_v<response::FloatType, Type> || std::is_same_v<response::StringType, Type>
+		|| std::is_same_v<response::BooleanType, Type> || std::is_same_v<response::IdType, Type>)
+		&& (sizeof...(Other) == 0
+			|| (sizeof...(Other) == 1
+				&& ((TypeModifier::None == Other || TypeModifier::Nullable == Other) && ...)));
+
+	template <TypeModifier... Other>
+	static constexpr bool is_nullable_element = ((TypeModifier::Nullable == Other) || ...);
+
+	static response::Value convertBuiltin(typename ResultTraits<Type>::type&& value)
+	{
+		if constexpr (std::is_same_v<response::IdType, Type>)
+		{
+			return response::Value(Base64::toBase64(value));
+		}
+		else
+		{
+			return response::Value(std::move(value));
+		}
+	}
+
 	// Peel off the none modifier. If it's included, it should always be last in the list.
 	template <TypeModifier Modifier = TypeModifier::None, TypeModifier... Other>
 	static typename std::enable_if_t<TypeModifier::None == Modifier && sizeof...(Other) == 0
@@ -662,7 +758,39 @@ struct ModifiedResult
 
 				using vector_type = std::decay_t<decltype(wrappedFuture.get())>;
 
-				if constexpr (!std::is_same_v<std::decay_t<typename vector_type::reference>,
+				if constexpr (is_builtin_list_element<Other...>)
+				{
+					response::Value data(response::Type::List);
+
+					if (!wrappedResult.empty())
+					{
+						blockSubFields(wrappedParams);
+					}
+
+					data.reserve(wrappedResult.size());
+
+					// Use a forwarding reference for the proxy objects in std::vector<bool>.
+					for (auto&& entry : wrappedResult)
+					{
+						if constexpr (is_nullable_element<Other...>)
+						{
+							data.emplace_back(
+								entry ? convertBuiltin(std::move(*entry)) : response::Value());
+						}
+						else
+						{
+							data.emplace_back(convertBuiltin(
+								typename ResultTraits<Type>::type { std::move(entry) }));
+						}
+					}
+
+					response::Value document(response::Type::Map);
+
+					document.emplace_back(std::string { strData }, std::move(data));
+
+					return document;
+				}
+				else if constexpr (!std::is_same_v<std::decay_t<typename vector_type::reference>,
 								  typename vector_type::value_type>)
 				{
 					// Special handling for std::vector<> specializations which don't return a
@@ -890,6 +1018,27 @@ GRAPHQLSERVICE_EXPORT std::future<response::Value> ModifiedResult<Object>::conve
 
 using TypeMap = std::unordered_map<std::string, std::shared_ptr<Object>>;
 
+// EntityCache maps (typename, id) pairs to resolved objects, e.g. for Relay Node lookups, so the
+// same entity can be reused by nested references and by later requests instead of looking it up
+// again. It is safe to share between threads, and mutations should call invalidate for any entity
+// that they modify.
+class EntityCache
+{
+public:
+	GRAPHQLSERVICE_EXPORT std::shared_ptr<Object> find(
+		std::string_view typeName, const response::IdType& id) const;
+	GRAPHQLSERVICE_EXPORT void insert(
+		std::string_view typeName, const response::IdType& id, std::shared_ptr<Object> entity);
+	GRAPHQLSERVICE_EXPORT void invalidate(std::string_view typeName, const response::IdType& id);
+	GRAPHQLSERVICE_EXPORT void clear();
+
+private:
+	using EntityKey = std::pair<std::string, response::IdType>;
+
+	mutable std::shared_mutex _mutex;
+	std::map<EntityKey, std::shared_ptr<Object>> _entities;
+};
+
 // You can still sub-class RequestState and use that in the state parameter to Request::subscribe
 // to add your own state to the service callbacks that you receive while executing the subscription
 // query.
@@ -899,6 +1048,18 @@ struct SubscriptionParams
 	peg::ast query;
 	std::string operationName;
 	response::Value variables;
+
+	// Deliver at most one event to this subscription per minInterval. If coalesce is true, the
+	// latest event which arrived too soon is kept until Request::deliverPending is called after
+	// the interval has passed, otherwise it is dropped without resolving anything.
+	std::chrono::milliseconds minInterval { 0 };
+	bool coalesce = false;
+
+	// If this is greater than 0, every deltaSnapshotInterval-th result is sent to the callback
+	// in full, and the results in between are replaced with a document which only has a "patch"
+	// member built by response::makePatch from the previous result. Results with errors are
+	// always sent in full. This only works with a SubscriptionCallback.
+	size_t deltaSnapshotInterval = 0;
 };
 
 // State which is captured and kept alive until all pending futures have been resolved for an
@@ -921,13 +1082,29 @@ struct OperationData : std::enable_shared_from_this<OperationData>
 // Subscription callbacks receive the response::Value representing the result of evaluating the
 // SelectionSet against the payload.
 using SubscriptionCallback = std::function<void(std::future<response::Value>)>;
+
+// Serialized subscription callbacks receive an immutable buffer with the result serialized by
+// the ResponseSerializer passed to Request::setSubscriptionSerializer. Subscriptions which share
+// the same result also share the same buffer.
+using SerializedSubscriptionCallback =
+	std::function<void(std::future<std::shared_ptr<const std::string>>)>;
 using SubscriptionArguments = std::unordered_map<std::string, response::Value>;
 using SubscriptionFilterCallback = std::function<bool(response::MapType::const_reference)>;
 
+// Filter key callbacks are called once for each subscription to a field when it is added, with
+// the coerced arguments of that field, and the subscription only matches events delivered with the
+// same key. See Request::setSubscriptionFilterKey.
+using SubscriptionFilterKeyCallback = std::function<std::string(const response::Value&)>;
+
+// Returns the current time for throttling subscriptions, see Request::setSubscriptionClock.
+using SubscriptionClock = std::function<std::chrono::steady_clock::time_point()>;
+
 // Subscriptions are stored in maps using these keys.
 using SubscriptionKey = size_t;
 using SubscriptionName = std::string;
 
+struct SubscriptionDocument;
+
 // Registration information for subscription, cached in the Request::subscribe call.
 struct SubscriptionData : std::enable_shared_from_this<SubscriptionData>
 {
@@ -945,6 +1122,89 @@ struct SubscriptionData : std::enable_shared_from_this<SubscriptionData>
 	std::string operationName;
 	SubscriptionCallback callback;
 	const peg::ast_node& selection;
+
+	// Computed once by the SubscriptionFilterKeyCallback for field, if there is one.
+	std::optional<std::string> filterKey;
+
+	// Assigned by Request::subscribe, and used to pick the delivery shard, see
+	// Request::setDeliveryShards.
+	SubscriptionKey key = 0;
+
+	// Identical subscriptions share the same non-empty group, see
+	// Request::setGroupSubscriptions.
+	std::string group;
+
+	// Subscriptions to the same document text share the same peg::ast in query, so this keeps it
+	// alive for Request to share with the next one. The fragments and directives in data depend on
+	// the variables, so each subscription has its own.
+	std::shared_ptr<const SubscriptionDocument> document;
+
+	// Set instead of callback if the subscription was added with a SerializedSubscriptionCallback.
+	SerializedSubscriptionCallback serializedCallback;
+
+	// Copied from SubscriptionParams, along with the state of the throttled events.
+	std::chrono::milliseconds minInterval { 0 };
+	bool coalesce = false;
+	std::mutex throttleMutex;
+	std::chrono::steady_clock::time_point lastDelivery;
+	std::optional<std::shared_ptr<Object>> pendingEvent;
+
+	// Copied from SubscriptionParams, along with the last result and how many results have been
+	// sent since the last full snapshot.
+	size_t deltaSnapshotInterval = 0;
+	std::mutex deltaMutex;
+	std::optional<response::Value> previousResult;
+	size_t deltaCount = 0;
+};
+
+using ResponseSerializer = std::function<std::string(response::Value&&)>;
+
+// ResponseCache holds serialized responses from Request::resolveCached, so a cache hit skips both
+// executing the operation and serializing the result. Entries are keyed on the text of the
+// document, the operation name, the variables, and RequestState::getCacheScope, and they expire
+// after the max-age computed by CacheControl.
+class ResponseCache
+{
+public:
+	struct Key
+	{
+		GRAPHQLSERVICE_EXPORT bool operator==(const Key& rhs) const noexcept;
+
+		std::string document;
+		std::string operationName;
+		std::string variables;
+		std::string scope;
+	};
+
+	GRAPHQLSERVICE_EXPORT explicit ResponseCache(
+		ResponseSerializer&& serialize, size_t maxEntries = 1024);
+
+	GRAPHQLSERVICE_EXPORT std::string serialize(response::Value&& document) const;
+
+	GRAPHQLSERVICE_EXPORT std::shared_ptr<const std::string> find(const Key& key);
+	GRAPHQLSERVICE_EXPORT void insert(
+		Key&& key, std::shared_ptr<const std::string> response, std::chrono::seconds maxAge);
+	GRAPHQLSERVICE_EXPORT void clear();
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const noexcept;
+	};
+
+	struct Entry
+	{
+		std::shared_ptr<const std::string> response;
+		Clock::time_point expiration;
+	};
+
+	const ResponseSerializer _serialize;
+	const size_t _maxEntries;
+
+	std::mutex _mutex;
+	std::unordered_map<Key, Entry, KeyHash> _entries;
 };
 
 // Request scans the fragment definitions and finds the right operation definition to interpret
@@ -957,22 +1217,88 @@ protected:
 	GRAPHQLSERVICE_EXPORT virtual ~Request() = default;
 
 public:
-	GRAPHQLSERVICE_EXPORT std::vector<schema_error> validate(peg::ast& query) const;
+	// Neither validate nor resolve modify the parsed document except to set peg::ast::validated,
+	// which is atomic. It is safe to share the same peg::ast between concurrent requests, e.g. from
+	// a cache of parsed documents, as long as it outlives all of them.
+	GRAPHQLSERVICE_EXPORT std::vector<schema_error> validate(const peg::ast& query) const;
+
+	// Stop validating as soon as maxErrors errors have been found and skip the remaining rules.
+	// This is useful for rejecting malformed or abusive requests as cheaply as possible, e.g.
+	// pass 1 if you only need to know whether or not the query is valid.
+	GRAPHQLSERVICE_EXPORT std::vector<schema_error> validate(
+		const peg::ast& query, size_t maxErrors) const;
+
+	// Limit the number of selections (fields, fragment spreads, and inline fragments) which may be
+	// expanded while validating or resolving a single operation. The default of 0 means there is no
+	// limit. Set this before sharing the Request with other threads.
+	GRAPHQLSERVICE_EXPORT void setMaxSelections(size_t maxSelections) noexcept;
+	GRAPHQLSERVICE_EXPORT size_t getMaxSelections() const noexcept;
+
+	// Group subscriptions with the same document, operation name, variables, and
+	// RequestState::getCacheScope when they are added, and resolve each group only once per call
+	// to deliver. Every callback in the group receives a copy of the same result, which was
+	// resolved with the RequestState of the first matching subscription. This is off by default,
+	// and it only applies to subscriptions added after it is enabled.
+	GRAPHQLSERVICE_EXPORT void setGroupSubscriptions(bool groupSubscriptions) noexcept;
+	GRAPHQLSERVICE_EXPORT bool getGroupSubscriptions() const noexcept;
+
+	// Split the subscriptions matching each call to deliver into this many shards. If deliver is
+	// called with std::launch::async, each shard after the first is delivered on its own thread,
+	// otherwise the shards are delivered one after another on the calling thread. Subscriptions are
+	// always assigned to the same shard, by group if they have one or by SubscriptionKey otherwise,
+	// and each shard delivers to them in the same order as a single thread would, so one
+	// subscription never receives events out of order. Filter callbacks passed to deliver must be
+	// safe to call from multiple threads at once. The default of 1 delivers everything in a single
+	// loop on the calling thread. Set this before sharing the Request with other threads.
+	GRAPHQLSERVICE_EXPORT void setDeliveryShards(size_t deliveryShards) noexcept;
+	GRAPHQLSERVICE_EXPORT size_t getDeliveryShards() const noexcept;
+
+	// Serialize the results for subscriptions with a SerializedSubscriptionCallback. Each distinct
+	// result is only serialized once per call to deliver, so combined with setGroupSubscriptions,
+	// every subscription in a group receives the same buffer. Set this before sharing the Request
+	// with other threads.
+	GRAPHQLSERVICE_EXPORT void setSubscriptionSerializer(ResponseSerializer&& serialize);
+
+	// Compute a filter key from the arguments of every subscription to this field when it is
+	// added, and index the subscriptions on that key. Delivering an event with a filter key only
+	// resolves the subscriptions with exactly the same key, without calling any filter callbacks.
+	// It only applies to subscriptions added after it is set, and an empty callback stops computing
+	// keys for new subscriptions to the field. Set this before sharing the Request with other
+	// threads.
+	GRAPHQLSERVICE_EXPORT void setSubscriptionFilterKey(
+		const SubscriptionName& field, SubscriptionFilterKeyCallback&& makeFilterKey);
+
+	// Replace std::chrono::steady_clock::now() when checking SubscriptionParams::minInterval in
+	// deliver and deliverPending, e.g. to control the time in a test. An empty SubscriptionClock
+	// restores the default. Set this before sharing the Request with other threads.
+	GRAPHQLSERVICE_EXPORT void setSubscriptionClock(SubscriptionClock&& clock);
 
 	GRAPHQLSERVICE_EXPORT std::pair<std::string, const peg::ast_node*> findOperationDefinition(
 		const peg::ast_node& root, const std::string& operationName) const;
 
 	GRAPHQLSERVICE_EXPORT std::future<response::Value> resolve(
-		const std::shared_ptr<RequestState>& state, peg::ast& query,
+		const std::shared_ptr<RequestState>& state, const peg::ast& query,
 		const std::string& operationName, response::Value&& variables) const;
 	GRAPHQLSERVICE_EXPORT std::future<response::Value> resolve(std::launch launch,
-		const std::shared_ptr<RequestState>& state, peg::ast& query,
+		const std::shared_ptr<RequestState>& state, const peg::ast& query,
 		const std::string& operationName, response::Value&& variables) const;
 
+	// Resolve the operation and serialize the result, or return a serialized response from the
+	// cache if there is one which has not expired yet. Successful responses are added to the cache
+	// if every root field has a @cacheControl(maxAge:) hint.
+	GRAPHQLSERVICE_EXPORT std::future<std::shared_ptr<const std::string>> resolveCached(
+		std::launch launch, const std::shared_ptr<RequestState>& state, const peg::ast& query,
+		const std::string& operationName, response::Value&& variables,
+		const std::shared_ptr<ResponseCache>& cache) const;
+
 	GRAPHQLSERVICE_EXPORT SubscriptionKey subscribe(
 		SubscriptionParams&& params, SubscriptionCallback&& callback);
 	GRAPHQLSERVICE_EXPORT std::future<SubscriptionKey> subscribe(
 		std::launch launch, SubscriptionParams&& params, SubscriptionCallback&& callback);
+	GRAPHQLSERVICE_EXPORT SubscriptionKey subscribe(
+		SubscriptionParams&& params, SerializedSubscriptionCallback&& callback);
+	GRAPHQLSERVICE_EXPORT std::future<SubscriptionKey> subscribe(std::launch launch,
+		SubscriptionParams&& params, SerializedSubscriptionCallback&& callback);
 
 	GRAPHQLSERVICE_EXPORT void unsubscribe(SubscriptionKey key);
 	GRAPHQLSERVICE_EXPORT std::future<void> unsubscribe(std::launch launch, SubscriptionKey key);
@@ -992,6 +1318,8 @@ public:
 		const SubscriptionFilterCallback& applyArguments,
 		const SubscriptionFilterCallback& applyDirectives,
 		const std::shared_ptr<Object>& subscriptionObject) const;
+	GRAPHQLSERVICE_EXPORT void deliver(const SubscriptionName& name, const std::string& filterKey,
+		const std::shared_ptr<Object>& subscriptionObject) const;
 
 	GRAPHQLSERVICE_EXPORT void deliver(std::launch launch, const SubscriptionName& name,
 		const std::shared_ptr<Object>& subscriptionObject) const;
@@ -1008,6 +1336,16 @@ public:
 		const SubscriptionFilterCallback& applyArguments,
 		const SubscriptionFilterCallback& applyDirectives,
 		const std::shared_ptr<Object>& subscriptionObject) const;
+	GRAPHQLSERVICE_EXPORT void deliver(std::launch launch, const SubscriptionName& name,
+		const std::string& filterKey, const std::shared_ptr<Object>& subscriptionObject) const;
+
+	// Deliver the latest event which was held back from each subscription with
+	// SubscriptionParams::coalesce, if its minInterval has passed. Returns when the next one will
+	// be ready, or std::nullopt if there aren't any more, so you can schedule the next call.
+	GRAPHQLSERVICE_EXPORT std::optional<std::chrono::steady_clock::time_point>
+	deliverPending() const;
+	GRAPHQLSERVICE_EXPORT std::optional<std::chrono::steady_clock::time_point> deliverPending(
+		std::launch launch) const;
 
 	[[deprecated("Use the Request::resolve overload which takes a peg::ast reference "
 				 "instead.")]] GRAPHQLSERVICE_EXPORT std::future<response::Value>
@@ -1022,14 +1360,123 @@ public:
 private:
 	std::future<response::Value> resolveValidated(std::launch launch,
 		const std::shared_ptr<RequestState>& state, const peg::ast_node& root,
-		const std::string& operationName, response::Value&& variables) const;
+		const std::string& operationName, response::Value&& variables,
+		const std::shared_ptr<CacheControl>& cacheControl = {}) const;
+
+	std::shared_ptr<SelectionCounter> makeSelectionCounter() const;
+
+	std::shared_ptr<SubscriptionData> addSubscription(SubscriptionParams&& params,
+		SubscriptionCallback&& callback, SerializedSubscriptionCallback&& serializedCallback);
+	std::future<SubscriptionKey> addSubscription(std::launch launch, SubscriptionParams&& params,
+		SubscriptionCallback&& callback, SerializedSubscriptionCallback&& serializedCallback);
+	std::shared_ptr<SubscriptionData> getSubscription(SubscriptionKey key) const;
+	template <class KeyContainer>
+	std::vector<std::shared_ptr<SubscriptionData>> getSubscriptions(const KeyContainer& keys) const;
+	void addArgumentIndex(SubscriptionKey key, const SubscriptionData& registration);
+	void removeArgumentIndex(SubscriptionKey key, const SubscriptionData& registration);
+	void deliverToRegistrations(std::launch launch,
+		const std::vector<std::shared_ptr<SubscriptionData>>& registrations,
+		const SubscriptionFilterCallback& applyArguments,
+		const SubscriptionFilterCallback& applyDirectives,
+		const std::shared_ptr<Object>& subscriptionObject, bool applyThrottle = true) const;
+	std::chrono::steady_clock::time_point getSubscriptionTime() const;
+	void deliverToShard(std::launch launch,
+		const std::vector<std::shared_ptr<SubscriptionData>>& registrations,
+		const SubscriptionFilterCallback& applyArguments,
+		const SubscriptionFilterCallback& applyDirectives,
+		const std::shared_ptr<Object>& subscriptionObject, bool applyThrottle) const;
+
+	// Subscriptions to each field are indexed on the canonical value of their first argument, so
+	// delivering an event with SubscriptionArguments only needs to check the subscriptions which
+	// could possibly match. Subscriptions without any arguments are indexed on an empty string.
+	using ArgumentIndex = std::unordered_map<std::string, std::set<SubscriptionKey>>;
 
 	TypeMap _operations;
+	size_t _maxSelections = 0;
+	bool _groupSubscriptions = false;
+	size_t _deliveryShards = 1;
+	ResponseSerializer _subscriptionSerializer;
+	std::unordered_map<SubscriptionName, SubscriptionFilterKeyCallback> _subscriptionFilterKeys;
+	SubscriptionClock _subscriptionClock;
+
+	// Guard the subscription registry, so subscribe and unsubscribe can be called from other
+	// threads while deliver is running. Deliver only holds a shared lock long enough to copy the
+	// matching registrations.
+	mutable std::shared_mutex _subscriptionMutex;
 	std::map<SubscriptionKey, std::shared_ptr<SubscriptionData>> _subscriptions;
 	std::unordered_map<SubscriptionName, std::set<SubscriptionKey>> _listeners;
+	std::unordered_map<SubscriptionName, ArgumentIndex> _argumentIndex;
+	std::unordered_map<SubscriptionName, ArgumentIndex> _filterKeyIndex;
+	std::set<SubscriptionKey> _coalescedListeners;
+
+	// Subscriptions with the same document text share the parsed and validated document. Expired
+	// entries are removed when the map doubles in size.
+	std::unordered_map<std::string, std::weak_ptr<const SubscriptionDocument>> _documents;
+	size_t _maxDocuments = 16;
+
+	// Keys are never reused, so a key which was unsubscribed on another thread can't refer to a
+	// different subscription later.
 	SubscriptionKey _nextKey = 0;
 };
 
+// How a SubscriptionDispatcher handles a subscription whose callback can't keep up with the events
+// being delivered to it.
+enum class SubscriptionOverflow
+{
+	DropOldest, // Discard the oldest pending result to make room for the new one.
+	Coalesce,	// Replace all of the pending results with the new one.
+	Disconnect, // Unsubscribe and invoke the callback one last time with an error.
+};
+
+// SubscriptionDispatcher delivers events to the subscriptions in a Request on its own worker
+// threads, so deliver returns as soon as the event has been queued. Each subscription has a bounded
+// queue of results waiting for its callback, so a slow callback only delays the events for that
+// subscription, and the SubscriptionOverflow policy decides what happens when its queue is full.
+// Events are delivered one at a time in the order they were queued, so each subscription receives
+// its results in order no matter how many workers there are. The workers run the callbacks for
+// different subscriptions in parallel. At most maxEvents events wait in the queue, and deliver
+// blocks until there's room for another one, unless it's called from one of the worker threads.
+class SubscriptionDispatcher
+{
+public:
+	GRAPHQLSERVICE_EXPORT explicit SubscriptionDispatcher(std::shared_ptr<Request> service,
+		size_t workerCount = 1, size_t maxPending = 16,
+		SubscriptionOverflow overflow = SubscriptionOverflow::DropOldest, size_t maxEvents = 256);
+	GRAPHQLSERVICE_EXPORT ~SubscriptionDispatcher();
+
+	SubscriptionDispatcher(const SubscriptionDispatcher&) = delete;
+	SubscriptionDispatcher& operator=(const SubscriptionDispatcher&) = delete;
+
+	GRAPHQLSERVICE_EXPORT SubscriptionKey subscribe(
+		SubscriptionParams&& params, SubscriptionCallback&& callback);
+	GRAPHQLSERVICE_EXPORT void unsubscribe(SubscriptionKey key);
+
+	GRAPHQLSERVICE_EXPORT void deliver(
+		const SubscriptionName& name, const std::shared_ptr<Object>& subscriptionObject);
+	GRAPHQLSERVICE_EXPORT void deliver(const SubscriptionName& name,
+		SubscriptionArguments&& arguments, const std::shared_ptr<Object>& subscriptionObject);
+	GRAPHQLSERVICE_EXPORT void deliver(const SubscriptionName& name,
+		SubscriptionArguments&& arguments, SubscriptionArguments&& directives,
+		const std::shared_ptr<Object>& subscriptionObject);
+	GRAPHQLSERVICE_EXPORT void deliver(const SubscriptionName& name,
+		SubscriptionFilterCallback&& applyArguments,
+		const std::shared_ptr<Object>& subscriptionObject);
+	GRAPHQLSERVICE_EXPORT void deliver(const SubscriptionName& name, std::string&& filterKey,
+		const std::shared_ptr<Object>& subscriptionObject);
+
+	// Wait until every queued event has been delivered and every callback has returned.
+	GRAPHQLSERVICE_EXPORT void flush();
+
+private:
+	struct State;
+
+	void enqueue(std::function<void()>&& event);
+
+	const std::shared_ptr<Request> _service;
+	const std::shared_ptr<State> _state;
+	std::vector<std::thread> _workers;
+};
+
 } /* namespace graphql::service */
 
 #endif // GRAPHQLSERVICE_H
@@ -20,11 +20,67 @@
 
 #include "graphqlservice/GraphQLResponse.h"
 
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string_view>
+
 namespace graphql::response {
 
+// Serialize the Value without modifying it, so the same Value can be serialized more than once.
+JSONRESPONSE_EXPORT std::string toJSON(const Value& response);
 JSONRESPONSE_EXPORT std::string toJSON(Value&& response);
 
-JSONRESPONSE_EXPORT Value parseJSON(const std::string& json);
+// Append the serialized Value to a reusable buffer, e.g. one which has already been reserved.
+JSONRESPONSE_EXPORT void toJSON(const Value& response, std::string& output);
+
+// Write the serialized Value directly to a std::ostream without building a std::string first.
+JSONRESPONSE_EXPORT void toJSON(const Value& response, std::ostream& output);
+
+// Pass the serialized Value to the callback in chunks of up to chunkSize bytes, e.g. to flush
+// each chunk to a socket. The std::string_view is only valid until the callback returns.
+using JSONChunkCallback = std::function<void(std::string_view chunk)>;
+
+JSONRESPONSE_EXPORT void toJSON(
+	const Value& response, const JSONChunkCallback& callback, size_t chunkSize = 4096);
+
+// Parse the JSON without copying it first. Strings are constructed with their decoded length, so
+// they may contain embedded NUL characters. Any Map, List, or Scalar values are allocated from
+// the current MemoryResourceScope.
+JSONRESPONSE_EXPORT Value parseJSON(std::string_view json);
+
+// Parse the JSON in place, decoding strings into the buffer instead of a separate stack. The
+// contents of json are overwritten.
+JSONRESPONSE_EXPORT Value parseJSONInsitu(std::string&& json);
+
+struct IncrementalParserState;
+
+// Parse a JSON document which arrives in several pieces, e.g. a chunked HTTP request body, as
+// each piece is received. Only a token which spans the boundary between two pieces is buffered,
+// so the pieces never need to be concatenated.
+class IncrementalJSONParser
+{
+public:
+	JSONRESPONSE_EXPORT IncrementalJSONParser();
+	JSONRESPONSE_EXPORT ~IncrementalJSONParser();
+
+	IncrementalJSONParser(const IncrementalJSONParser&) = delete;
+	IncrementalJSONParser& operator=(const IncrementalJSONParser&) = delete;
+
+	// Parse the next piece of the document. Throws std::runtime_error if it is not valid JSON.
+	JSONRESPONSE_EXPORT void push(std::string_view chunk);
+
+	// Check if the top-level value is complete. A top-level number, true, false, or null is not
+	// complete until the next character or the call to finish.
+	JSONRESPONSE_EXPORT bool done() const noexcept;
+
+	// Get the parsed Value at the end of the document. Throws std::runtime_error if the document
+	// is incomplete.
+	JSONRESPONSE_EXPORT Value finish();
+
+private:
+	std::unique_ptr<IncrementalParserState> _state;
+};
 
 } /* namespace graphql::response */
 
@@ -183,6 +183,7 @@ service::FieldResult<std::shared_ptr<NestedType>> Query::getNested(service::Fiel
 
 std::future<response::Value> Query::resolveNested(service::ResolverParams&& params)
 {
+	params.hintCacheMaxAge(std::chrono::seconds { 60 });
 	std::unique_lock resolverLock(_resolverMutex);
 	auto result = getNested(service::FieldParams(params, std::move(params.fieldDirectives)));
 	resolverLock.unlock();
@@ -8,6 +8,8 @@
 
 namespace graphql::today {
 
+using namespace std::literals;
+
 Appointment::Appointment(
 	response::IdType&& id, std::string&& when, std::string&& subject, bool isNow)
 	: _id(std::move(id))
@@ -32,10 +34,11 @@ Folder::Folder(response::IdType&& id, std::string&& name, int unreadCount)
 }
 
 Query::Query(appointmentsLoader&& getAppointments, tasksLoader&& getTasks,
-	unreadCountsLoader&& getUnreadCounts)
+	unreadCountsLoader&& getUnreadCounts, std::shared_ptr<service::EntityCache> entityCache)
 	: _getAppointments(std::move(getAppointments))
 	, _getTasks(std::move(getTasks))
 	, _getUnreadCounts(getUnreadCounts)
+	, _entityCache(std::move(entityCache))
 {
 }
 
@@ -59,16 +62,25 @@ void Query::loadAppointments(const std::shared_ptr<service::RequestState>& state
 std::shared_ptr<Appointment> Query::findAppointment(
 	const service::FieldParams& params, const response::IdType& id) const
 {
+	if (_entityCache)
+	{
+		if (auto cached = _entityCache->find("Appointment"sv, id))
+		{
+			return std::static_pointer_cast<Appointment>(cached);
+		}
+	}
+
 	loadAppointments(params.state);
 
 	for (const auto& appointment : _appointments)
 	{
-		auto appointmentId =
-			appointment->getId(service::FieldParams(params, response::Value(response::Type::Map)))
-				.get();
-
-		if (appointmentId == id)
+		if (appointment->id() == id)
 		{
+			if (_entityCache)
+			{
+				_entityCache->insert("Appointment"sv, id, appointment);
+			}
+
 			return appointment;
 		}
 	}
@@ -96,15 +108,25 @@ void Query::loadTasks(const std::shared_ptr<service::RequestState>& state) const
 std::shared_ptr<Task> Query::findTask(
 	const service::FieldParams& params, const response::IdType& id) const
 {
+	if (_entityCache)
+	{
+		if (auto cached = _entityCache->find("Task"sv, id))
+		{
+			return std::static_pointer_cast<Task>(cached);
+		}
+	}
+
 	loadTasks(params.state);
 
 	for (const auto& task : _tasks)
 	{
-		auto taskId =
-			task->getId(service::FieldParams(params, response::Value(response::Type::Map))).get();
-
-		if (taskId == id)
+		if (task->id() == id)
 		{
+			if (_entityCache)
+			{
+				_entityCache->insert("Task"sv, id, task);
+			}
+
 			return task;
 		}
 	}
@@ -132,15 +154,25 @@ void Query::loadUnreadCounts(const std::shared_ptr<service::RequestState>& state
 std::shared_ptr<Folder> Query::findUnreadCount(
 	const service::FieldParams& params, const response::IdType& id) const
 {
+	if (_entityCache)
+	{
+		if (auto cached = _entityCache->find("Folder"sv, id))
+		{
+			return std::static_pointer_cast<Folder>(cached);
+		}
+	}
+
 	loadUnreadCounts(params.state);
 
 	for (const auto& folder : _unreadCounts)
 	{
-		auto folderId =
-			folder->getId(service::FieldParams(params, response::Value(response::Type::Map))).get();
-
-		if (folderId == id)
+		if (folder->id() == id)
 		{
+			if (_entityCache)
+			{
+				_entityCache->insert("Folder"sv, id, folder);
+			}
+
 			return folder;
 		}
 	}
@@ -444,8 +476,10 @@ service::FieldResult<std::vector<std::shared_ptr<object::Expensive>>> Query::get
 	return result;
 }
 
-Mutation::Mutation(completeTaskMutation&& mutateCompleteTask)
+Mutation::Mutation(
+	completeTaskMutation&& mutateCompleteTask, std::shared_ptr<service::EntityCache> entityCache)
 	: _mutateCompleteTask(std::move(mutateCompleteTask))
+	, _entityCache(std::move(entityCache))
 {
 }
 
@@ -453,9 +487,17 @@ service::FieldResult<std::shared_ptr<object::CompleteTaskPayload>> Mutation::app
 	service::FieldParams&& params, CompleteTaskInput&& input) const
 {
 	std::promise<std::shared_ptr<object::CompleteTaskPayload>> promise;
+	const auto id = input.id;
 
 	promise.set_value(_mutateCompleteTask(std::move(input)));
 
+	if (_entityCache)
+	{
+		// The cached Task is stale once it has been modified. Invalidate it afterwards, so a
+		// concurrent lookup can't cache the old Task again while the mutation is running.
+		_entityCache->invalidate("Task"sv, id);
+	}
+
 	return promise.get_future();
 }
 
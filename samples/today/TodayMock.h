@@ -48,7 +48,8 @@ public:
 	using unreadCountsLoader = std::function<std::vector<std::shared_ptr<Folder>>()>;
 
 	explicit Query(appointmentsLoader&& getAppointments, tasksLoader&& getTasks,
-		unreadCountsLoader&& getUnreadCounts);
+		unreadCountsLoader&& getUnreadCounts,
+		std::shared_ptr<service::EntityCache> entityCache = {});
 
 	service::FieldResult<std::shared_ptr<service::Object>> getNode(
 		service::FieldParams&& params, response::IdType&& id) const final;
@@ -95,6 +96,8 @@ private:
 	mutable std::vector<std::shared_ptr<Appointment>> _appointments;
 	mutable std::vector<std::shared_ptr<Task>> _tasks;
 	mutable std::vector<std::shared_ptr<Folder>> _unreadCounts;
+
+	const std::shared_ptr<service::EntityCache> _entityCache;
 };
 
 class PageInfo : public object::PageInfo
@@ -441,7 +444,8 @@ public:
 	using completeTaskMutation =
 		std::function<std::shared_ptr<CompleteTaskPayload>(CompleteTaskInput&&)>;
 
-	explicit Mutation(completeTaskMutation&& mutateCompleteTask);
+	explicit Mutation(completeTaskMutation&& mutateCompleteTask,
+		std::shared_ptr<service::EntityCache> entityCache = {});
 
 	static double getFloat() noexcept;
 
@@ -452,6 +456,7 @@ public:
 
 private:
 	completeTaskMutation _mutateCompleteTask;
+	const std::shared_ptr<service::EntityCache> _entityCache;
 	static std::optional<response::FloatType> _setFloat;
 };
 
@@ -258,6 +258,7 @@ service::FieldResult<std::shared_ptr<NestedType>> Query::getNested(service::Fiel
 
 std::future<response::Value> Query::resolveNested(service::ResolverParams&& params)
 {
+	params.hintCacheMaxAge(std::chrono::seconds { 60 });
 	std::unique_lock resolverLock(_resolverMutex);
 	auto result = getNested(service::FieldParams(params, std::move(params.fieldDirectives)));
 	resolverLock.unlock();
@@ -1223,6 +1224,11 @@ void AddTypesToSchema(const std::shared_ptr<introspection::Schema>& schema)
 	schema->AddDirective(std::make_shared<introspection::Directive>("id", R"md()md", std::vector<response::StringType>({
 		R"gql(FIELD_DEFINITION)gql"
 	}), std::vector<std::shared_ptr<introspection::InputValue>>()));
+	schema->AddDirective(std::make_shared<introspection::Directive>("cacheControl", R"md()md", std::vector<response::StringType>({
+		R"gql(FIELD_DEFINITION)gql"
+	}), std::vector<std::shared_ptr<introspection::InputValue>>({
+		std::make_shared<introspection::InputValue>("maxAge", R"md()md", schema->WrapType(introspection::TypeKind::NON_NULL, schema->LookupType("Int")), R"gql()gql")
+	})));
 	schema->AddDirective(std::make_shared<introspection::Directive>("subscriptionTag", R"md()md", std::vector<response::StringType>({
 		R"gql(SUBSCRIPTION)gql"
 	}), std::vector<std::shared_ptr<introspection::InputValue>>({
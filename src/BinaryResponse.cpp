@@ -0,0 +1,1032 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+
+#include "graphqlservice/BinaryResponse.h"
+
+#include "graphqlservice/GraphQLService.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+
+namespace graphql::response {
+
+namespace {
+
+// Append an unsigned integer to the buffer in big-endian (network) order.
+void appendBigEndian(std::vector<uint8_t>& buffer, uint64_t value, size_t bytes)
+{
+	for (size_t i = bytes; i > 0; --i)
+	{
+		buffer.push_back(static_cast<uint8_t>(value >> ((i - 1) * 8)));
+	}
+}
+
+uint64_t doubleToBits(FloatType value) noexcept
+{
+	uint64_t bits;
+
+	std::memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+FloatType bitsToDouble(uint64_t bits) noexcept
+{
+	FloatType value;
+
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+FloatType bitsToFloat(uint32_t bits) noexcept
+{
+	float value;
+
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+IntType checkedInt(int64_t value)
+{
+	if (value < std::numeric_limits<IntType>::min() || value > std::numeric_limits<IntType>::max())
+	{
+		// https://facebook.github.io/graphql/June2018/#sec-Int
+		throw std::overflow_error("GraphQL only supports 32-bit signed integers");
+	}
+
+	return static_cast<IntType>(value);
+}
+
+} // namespace
+
+// Both decoders read from a bounded range of bytes and throw if an item runs past the end.
+class BinaryReader
+{
+public:
+	explicit BinaryReader(const uint8_t* data, size_t size)
+		: _data(data)
+		, _size(size)
+	{
+	}
+
+	bool atEnd() const noexcept
+	{
+		return _position == _size;
+	}
+
+	uint8_t peek() const
+	{
+		require(1);
+		return _data[_position];
+	}
+
+	uint8_t readByte()
+	{
+		require(1);
+		return _data[_position++];
+	}
+
+	uint64_t readBigEndian(size_t bytes)
+	{
+		require(bytes);
+
+		uint64_t value = 0;
+
+		for (size_t i = 0; i < bytes; ++i)
+		{
+			value = (value << 8) | _data[_position++];
+		}
+
+		return value;
+	}
+
+	const uint8_t* readBytes(uint64_t count)
+	{
+		require(count);
+
+		const auto bytes = _data + _position;
+
+		_position += static_cast<size_t>(count);
+		return bytes;
+	}
+
+	// Never reserve more entries than there are bytes left, so a corrupt length can't trigger a
+	// huge allocation before we notice that the data is truncated.
+	size_t reserveLimit(uint64_t count) const noexcept
+	{
+		return static_cast<size_t>(std::min<uint64_t>(count, _size - _position));
+	}
+
+	[[noreturn]] void fail(const char* message) const
+	{
+		std::ostringstream error;
+
+		error << "Invalid binary response at offset: " << _position << " " << message;
+		throw std::runtime_error(error.str());
+	}
+
+private:
+	void require(uint64_t count) const
+	{
+		if (count > _size - _position)
+		{
+			fail("unexpected end of data");
+		}
+	}
+
+	const uint8_t* const _data;
+	const size_t _size;
+	size_t _position = 0;
+};
+
+// CBOR major types, https://tools.ietf.org/html/rfc7049#section-2.1
+enum class CBORMajor : uint8_t
+{
+	UnsignedInt = 0,
+	NegativeInt = 1,
+	ByteString = 2,
+	TextString = 3,
+	Array = 4,
+	Map = 5,
+	Tag = 6,
+	Simple = 7,
+};
+
+constexpr uint8_t cborIndefinite = 31;
+constexpr uint8_t cborBreak = 0xFF;
+constexpr uint8_t cborFalse = 0xF4;
+constexpr uint8_t cborTrue = 0xF5;
+constexpr uint8_t cborNull = 0xF6;
+constexpr uint8_t cborDouble = 0xFB;
+
+class CBORWriter
+{
+public:
+	std::vector<uint8_t> write(const Value& response)
+	{
+		writeValue(response);
+		return std::move(_buffer);
+	}
+
+private:
+	void writeHead(CBORMajor major, uint64_t argument)
+	{
+		const auto type = static_cast<uint8_t>(static_cast<uint8_t>(major) << 5);
+
+		if (argument < 24)
+		{
+			_buffer.push_back(static_cast<uint8_t>(type | argument));
+		}
+		else if (argument <= std::numeric_limits<uint8_t>::max())
+		{
+			_buffer.push_back(type | 24);
+			appendBigEndian(_buffer, argument, 1);
+		}
+		else if (argument <= std::numeric_limits<uint16_t>::max())
+		{
+			_buffer.push_back(type | 25);
+			appendBigEndian(_buffer, argument, 2);
+		}
+		else if (argument <= std::numeric_limits<uint32_t>::max())
+		{
+			_buffer.push_back(type | 26);
+			appendBigEndian(_buffer, argument, 4);
+		}
+		else
+		{
+			_buffer.push_back(type | 27);
+			appendBigEndian(_buffer, argument, 8);
+		}
+	}
+
+	void writeText(const std::string& value)
+	{
+		writeHead(CBORMajor::TextString, value.size());
+		_buffer.insert(_buffer.end(), value.cbegin(), value.cend());
+	}
+
+	void writeValue(const Value& response)
+	{
+		switch (response.type())
+		{
+			case Type::Map:
+				writeHead(CBORMajor::Map, response.size());
+
+				for (const auto& entry : response)
+				{
+					writeText(entry.first);
+					writeValue(entry.second);
+				}
+				break;
+
+			case Type::List:
+			{
+				const auto& list = response.get<ListType>();
+
+				writeHead(CBORMajor::Array, list.size());
+
+				for (const auto& entry : list)
+				{
+					writeValue(entry);
+				}
+				break;
+			}
+
+			case Type::String:
+				writeText(response.get<StringType>());
+				break;
+
+			case Type::EnumValue:
+				writeHead(CBORMajor::Tag, cborEnumValueTag);
+				writeText(response.get<StringType>());
+				break;
+
+			case Type::Null:
+				_buffer.push_back(cborNull);
+				break;
+
+			case Type::Boolean:
+				_buffer.push_back(response.get<BooleanType>() ? cborTrue : cborFalse);
+				break;
+
+			case Type::Int:
+			{
+				const auto value = static_cast<int64_t>(response.get<IntType>());
+
+				if (value >= 0)
+				{
+					writeHead(CBORMajor::UnsignedInt, static_cast<uint64_t>(value));
+				}
+				else
+				{
+					writeHead(CBORMajor::NegativeInt, static_cast<uint64_t>(-1 - value));
+				}
+				break;
+			}
+
+			case Type::Float:
+				_buffer.push_back(cborDouble);
+				appendBigEndian(_buffer, doubleToBits(response.get<FloatType>()), 8);
+				break;
+
+			case Type::Scalar:
+				writeHead(CBORMajor::Tag, cborScalarTag);
+				writeValue(response.get<ScalarType>());
+				break;
+		}
+	}
+
+	std::vector<uint8_t> _buffer;
+};
+
+class CBORReader
+{
+public:
+	explicit CBORReader(const std::vector<uint8_t>& cbor)
+		: _reader(cbor.data(), cbor.size())
+	{
+	}
+
+	Value read()
+	{
+		auto result = readValue();
+
+		if (!_reader.atEnd())
+		{
+			_reader.fail("unexpected data after the end of the CBOR item");
+		}
+
+		return result;
+	}
+
+private:
+	// Returns the argument of the head, or nullopt for an indefinite-length item.
+	std::optional<uint64_t> readArgument(uint8_t info)
+	{
+		if (info < 24)
+		{
+			return info;
+		}
+
+		switch (info)
+		{
+			case 24:
+				return _reader.readBigEndian(1);
+
+			case 25:
+				return _reader.readBigEndian(2);
+
+			case 26:
+				return _reader.readBigEndian(4);
+
+			case 27:
+				return _reader.readBigEndian(8);
+
+			case cborIndefinite:
+				return std::nullopt;
+
+			default:
+				_reader.fail("invalid additional information");
+		}
+	}
+
+	bool readBreak()
+	{
+		if (_reader.peek() == cborBreak)
+		{
+			_reader.readByte();
+			return true;
+		}
+
+		return false;
+	}
+
+	std::string readString(CBORMajor major, std::optional<uint64_t> length)
+	{
+		std::string result;
+
+		if (length)
+		{
+			const auto bytes = _reader.readBytes(*length);
+
+			result.assign(reinterpret_cast<const char*>(bytes), static_cast<size_t>(*length));
+			return result;
+		}
+
+		// Indefinite-length strings are a sequence of definite-length chunks of the same type.
+		while (!readBreak())
+		{
+			const auto head = _reader.readByte();
+			const auto chunkLength = readArgument(head & 0x1F);
+
+			if (static_cast<CBORMajor>(head >> 5) != major || !chunkLength)
+			{
+				_reader.fail("invalid indefinite-length string chunk");
+			}
+
+			result.append(readString(major, chunkLength));
+		}
+
+		return result;
+	}
+
+	std::string readText()
+	{
+		const auto head = _reader.readByte();
+
+		if (static_cast<CBORMajor>(head >> 5) != CBORMajor::TextString)
+		{
+			_reader.fail("expected a text string");
+		}
+
+		return readString(CBORMajor::TextString, readArgument(head & 0x1F));
+	}
+
+	Value readValue()
+	{
+		const auto head = _reader.readByte();
+		const auto major = static_cast<CBORMajor>(head >> 5);
+		const uint8_t info = head & 0x1F;
+
+		if (major == CBORMajor::Simple)
+		{
+			return readSimple(info);
+		}
+
+		const auto argument = readArgument(info);
+
+		switch (major)
+		{
+			case CBORMajor::UnsignedInt:
+			case CBORMajor::NegativeInt:
+			{
+				if (!argument
+					|| *argument > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+				{
+					throw std::overflow_error("GraphQL only supports 32-bit signed integers");
+				}
+
+				const auto value = static_cast<int64_t>(*argument);
+
+				return Value(checkedInt(major == CBORMajor::UnsignedInt ? value : -1 - value));
+			}
+
+			case CBORMajor::ByteString:
+			{
+				const auto bytes = readString(major, argument);
+
+				return Value(service::Base64::toBase64({ bytes.cbegin(), bytes.cend() }));
+			}
+
+			case CBORMajor::TextString:
+				return Value(readString(major, argument));
+
+			case CBORMajor::Array:
+			{
+				Value result(Type::List);
+
+				if (argument)
+				{
+					result.reserve(_reader.reserveLimit(*argument));
+
+					for (uint64_t i = 0; i < *argument; ++i)
+					{
+						result.emplace_back(readValue());
+					}
+				}
+				else
+				{
+					while (!readBreak())
+					{
+						result.emplace_back(readValue());
+					}
+				}
+
+				return result;
+			}
+
+			case CBORMajor::Map:
+			{
+				Value result(Type::Map);
+
+				if (argument)
+				{
+					result.reserve(_reader.reserveLimit(*argument));
+
+					for (uint64_t i = 0; i < *argument; ++i)
+					{
+						auto name = readText();
+
+						result.emplace_back(std::move(name), readValue());
+					}
+				}
+				else
+				{
+					while (!readBreak())
+					{
+						auto name = readText();
+
+						result.emplace_back(std::move(name), readValue());
+					}
+				}
+
+				return result;
+			}
+
+			case CBORMajor::Tag:
+			{
+				if (!argument)
+				{
+					_reader.fail("invalid indefinite-length tag");
+				}
+
+				if (*argument == cborEnumValueTag)
+				{
+					Value result(Type::EnumValue);
+
+					result.set<StringType>(readText());
+					return result;
+				}
+
+				if (*argument == cborScalarTag)
+				{
+					Value result(Type::Scalar);
+
+					result.set<ScalarType>(readValue());
+					return result;
+				}
+
+				// Ignore any other tags and just decode the tagged item.
+				return readValue();
+			}
+
+			default:
+				_reader.fail("invalid major type");
+		}
+	}
+
+	Value readSimple(uint8_t info)
+	{
+		switch (info)
+		{
+			case cborFalse & 0x1F:
+				return Value(false);
+
+			case cborTrue & 0x1F:
+				return Value(true);
+
+			case cborNull & 0x1F:
+			case (cborNull & 0x1F) + 1: // undefined
+				return Value();
+
+			case 25:
+				return Value(halfToDouble(static_cast<uint16_t>(_reader.readBigEndian(2))));
+
+			case 26:
+				return Value(bitsToFloat(static_cast<uint32_t>(_reader.readBigEndian(4))));
+
+			case cborDouble & 0x1F:
+				return Value(bitsToDouble(_reader.readBigEndian(8)));
+
+			default:
+				_reader.fail("unsupported simple value");
+		}
+	}
+
+	// https://tools.ietf.org/html/rfc7049#appendix-D
+	static FloatType halfToDouble(uint16_t half) noexcept
+	{
+		const int exponent = (half >> 10) & 0x1F;
+		const int mantissa = half & 0x3FF;
+		FloatType value;
+
+		if (exponent == 0)
+		{
+			value = std::ldexp(mantissa, -24);
+		}
+		else if (exponent != 31)
+		{
+			value = std::ldexp(mantissa + 1024, exponent - 25);
+		}
+		else
+		{
+			value = (mantissa == 0 ? std::numeric_limits<FloatType>::infinity()
+								   : std::numeric_limits<FloatType>::quiet_NaN());
+		}
+
+		return (half & 0x8000) ? -value : value;
+	}
+
+	BinaryReader _reader;
+};
+
+std::vector<uint8_t> toCBOR(const Value& response)
+{
+	return CBORWriter().write(response);
+}
+
+Value fromCBOR(const std::vector<uint8_t>& cbor)
+{
+	return CBORReader(cbor).read();
+}
+
+// MessagePack formats, https://github.com/msgpack/msgpack/blob/master/spec.md
+constexpr uint8_t messagePackNil = 0xC0;
+constexpr uint8_t messagePackFalse = 0xC2;
+constexpr uint8_t messagePackTrue = 0xC3;
+constexpr uint8_t messagePackBin8 = 0xC4;
+constexpr uint8_t messagePackBin16 = 0xC5;
+constexpr uint8_t messagePackBin32 = 0xC6;
+constexpr uint8_t messagePackExt8 = 0xC7;
+constexpr uint8_t messagePackExt16 = 0xC8;
+constexpr uint8_t messagePackExt32 = 0xC9;
+constexpr uint8_t messagePackFloat32 = 0xCA;
+constexpr uint8_t messagePackFloat64 = 0xCB;
+constexpr uint8_t messagePackUint8 = 0xCC;
+constexpr uint8_t messagePackUint16 = 0xCD;
+constexpr uint8_t messagePackUint32 = 0xCE;
+constexpr uint8_t messagePackUint64 = 0xCF;
+constexpr uint8_t messagePackInt8 = 0xD0;
+constexpr uint8_t messagePackInt16 = 0xD1;
+constexpr uint8_t messagePackInt32 = 0xD2;
+constexpr uint8_t messagePackInt64 = 0xD3;
+constexpr uint8_t messagePackFixExt1 = 0xD4;
+constexpr uint8_t messagePackFixExt16 = 0xD8;
+constexpr uint8_t messagePackStr8 = 0xD9;
+constexpr uint8_t messagePackStr16 = 0xDA;
+constexpr uint8_t messagePackStr32 = 0xDB;
+constexpr uint8_t messagePackArray16 = 0xDC;
+constexpr uint8_t messagePackArray32 = 0xDD;
+constexpr uint8_t messagePackMap16 = 0xDE;
+constexpr uint8_t messagePackMap32 = 0xDF;
+
+class MessagePackWriter
+{
+public:
+	std::vector<uint8_t> write(const Value& response)
+	{
+		writeValue(response);
+		return std::move(_buffer);
+	}
+
+private:
+	// Write the header for a str, array, map, or ext with the smallest format that fits.
+	void writeHead(uint8_t fixFormat, size_t fixLimit, uint8_t format8, uint8_t format16,
+		uint8_t format32, size_t size)
+	{
+		if (size < fixLimit)
+		{
+			_buffer.push_back(static_cast<uint8_t>(fixFormat | size));
+		}
+		else if (format8 != 0 && size <= std::numeric_limits<uint8_t>::max())
+		{
+			_buffer.push_back(format8);
+			appendBigEndian(_buffer, size, 1);
+		}
+		else if (size <= std::numeric_limits<uint16_t>::max())
+		{
+			_buffer.push_back(format16);
+			appendBigEndian(_buffer, size, 2);
+		}
+		else if (size <= std::numeric_limits<uint32_t>::max())
+		{
+			_buffer.push_back(format32);
+			appendBigEndian(_buffer, size, 4);
+		}
+		else
+		{
+			throw std::length_error("MessagePack does not support more than 2^32 - 1 entries");
+		}
+	}
+
+	void writeString(const std::string& value)
+	{
+		writeHead(0xA0, 32, messagePackStr8, messagePackStr16, messagePackStr32, value.size());
+		_buffer.insert(_buffer.end(), value.cbegin(), value.cend());
+	}
+
+	void writeExt(int8_t type, const std::vector<uint8_t>& payload)
+	{
+		// Skip the fixext formats, so the fixLimit is 0.
+		writeHead(0, 0, messagePackExt8, messagePackExt16, messagePackExt32, payload.size());
+		_buffer.push_back(static_cast<uint8_t>(type));
+		_buffer.insert(_buffer.end(), payload.cbegin(), payload.cend());
+	}
+
+	void writeValue(const Value& response)
+	{
+		switch (response.type())
+		{
+			case Type::Map:
+				writeHead(0x80, 16, 0, messagePackMap16, messagePackMap32, response.size());
+
+				for (const auto& entry : response)
+				{
+					writeString(entry.first);
+					writeValue(entry.second);
+				}
+				break;
+
+			case Type::List:
+			{
+				const auto& list = response.get<ListType>();
+
+				writeHead(0x90, 16, 0, messagePackArray16, messagePackArray32, list.size());
+
+				for (const auto& entry : list)
+				{
+					writeValue(entry);
+				}
+				break;
+			}
+
+			case Type::String:
+				writeString(response.get<StringType>());
+				break;
+
+			case Type::EnumValue:
+			{
+				const auto& value = response.get<StringType>();
+
+				writeExt(messagePackEnumValueType, { value.cbegin(), value.cend() });
+				break;
+			}
+
+			case Type::Null:
+				_buffer.push_back(messagePackNil);
+				break;
+
+			case Type::Boolean:
+				_buffer.push_back(response.get<BooleanType>() ? messagePackTrue : messagePackFalse);
+				break;
+
+			case Type::Int:
+				writeInt(response.get<IntType>());
+				break;
+
+			case Type::Float:
+				_buffer.push_back(messagePackFloat64);
+				appendBigEndian(_buffer, doubleToBits(response.get<FloatType>()), 8);
+				break;
+
+			case Type::Scalar:
+				writeExt(messagePackScalarType,
+					MessagePackWriter().write(response.get<ScalarType>()));
+				break;
+		}
+	}
+
+	void writeInt(IntType value)
+	{
+		if (value >= 0)
+		{
+			if (value < 0x80)
+			{
+				// positive fixint
+				_buffer.push_back(static_cast<uint8_t>(value));
+			}
+			else if (value <= std::numeric_limits<uint8_t>::max())
+			{
+				_buffer.push_back(messagePackUint8);
+				appendBigEndian(_buffer, static_cast<uint64_t>(value), 1);
+			}
+			else if (value <= std::numeric_limits<uint16_t>::max())
+			{
+				_buffer.push_back(messagePackUint16);
+				appendBigEndian(_buffer, static_cast<uint64_t>(value), 2);
+			}
+			else
+			{
+				_buffer.push_back(messagePackUint32);
+				appendBigEndian(_buffer, static_cast<uint64_t>(value), 4);
+			}
+		}
+		else if (value >= -32)
+		{
+			// negative fixint
+			_buffer.push_back(static_cast<uint8_t>(value));
+		}
+		else if (value >= std::numeric_limits<int8_t>::min())
+		{
+			_buffer.push_back(messagePackInt8);
+			appendBigEndian(_buffer, static_cast<uint8_t>(value), 1);
+		}
+		else if (value >= std::numeric_limits<int16_t>::min())
+		{
+			_buffer.push_back(messagePackInt16);
+			appendBigEndian(_buffer, static_cast<uint16_t>(value), 2);
+		}
+		else
+		{
+			_buffer.push_back(messagePackInt32);
+			appendBigEndian(_buffer, static_cast<uint32_t>(value), 4);
+		}
+	}
+
+	std::vector<uint8_t> _buffer;
+};
+
+class MessagePackReader
+{
+public:
+	explicit MessagePackReader(const uint8_t* data, size_t size)
+		: _reader(data, size)
+	{
+	}
+
+	Value read()
+	{
+		auto result = readValue();
+
+		if (!_reader.atEnd())
+		{
+			_reader.fail("unexpected data after the end of the MessagePack object");
+		}
+
+		return result;
+	}
+
+private:
+	std::string readString(uint64_t length)
+	{
+		const auto bytes = _reader.readBytes(length);
+
+		return std::string(reinterpret_cast<const char*>(bytes), static_cast<size_t>(length));
+	}
+
+	std::string readKey()
+	{
+		const auto format = _reader.readByte();
+
+		if ((format & 0xE0) == 0xA0)
+		{
+			return readString(format & 0x1F);
+		}
+
+		switch (format)
+		{
+			case messagePackStr8:
+				return readString(_reader.readBigEndian(1));
+
+			case messagePackStr16:
+				return readString(_reader.readBigEndian(2));
+
+			case messagePackStr32:
+				return readString(_reader.readBigEndian(4));
+
+			default:
+				_reader.fail("expected a str");
+		}
+	}
+
+	Value readArray(uint64_t count)
+	{
+		Value result(Type::List);
+
+		result.reserve(_reader.reserveLimit(count));
+
+		for (uint64_t i = 0; i < count; ++i)
+		{
+			result.emplace_back(readValue());
+		}
+
+		return result;
+	}
+
+	Value readMap(uint64_t count)
+	{
+		Value result(Type::Map);
+
+		result.reserve(_reader.reserveLimit(count));
+
+		for (uint64_t i = 0; i < count; ++i)
+		{
+			auto name = readKey();
+
+			result.emplace_back(std::move(name), readValue());
+		}
+
+		return result;
+	}
+
+	Value readBin(uint64_t length)
+	{
+		const auto bytes = _reader.readBytes(length);
+
+		return Value(service::Base64::toBase64({ bytes, bytes + length }));
+	}
+
+	Value readExt(uint64_t length)
+	{
+		const auto type = static_cast<int8_t>(_reader.readByte());
+		const auto bytes = _reader.readBytes(length);
+
+		switch (type)
+		{
+			case messagePackEnumValueType:
+			{
+				Value result(Type::EnumValue);
+
+				result.set<StringType>(
+					std::string(reinterpret_cast<const char*>(bytes), static_cast<size_t>(length)));
+				return result;
+			}
+
+			case messagePackScalarType:
+			{
+				Value result(Type::Scalar);
+
+				result.set<ScalarType>(
+					MessagePackReader(bytes, static_cast<size_t>(length)).read());
+				return result;
+			}
+
+			default:
+				_reader.fail("unsupported ext type");
+		}
+	}
+
+	Value readValue()
+	{
+		const auto format = _reader.readByte();
+
+		if (format < 0x80)
+		{
+			// positive fixint
+			return Value(static_cast<IntType>(format));
+		}
+		else if (format >= 0xE0)
+		{
+			// negative fixint
+			return Value(static_cast<IntType>(static_cast<int8_t>(format)));
+		}
+
+		switch (format & 0xF0)
+		{
+			case 0x80:
+				return readMap(format & 0x0F);
+
+			case 0x90:
+				return readArray(format & 0x0F);
+
+			case 0xA0:
+			case 0xB0:
+				return Value(readString(format & 0x1F));
+
+			default:
+				break;
+		}
+
+		switch (format)
+		{
+			case messagePackNil:
+				return Value();
+
+			case messagePackFalse:
+				return Value(false);
+
+			case messagePackTrue:
+				return Value(true);
+
+			case messagePackBin8:
+				return readBin(_reader.readBigEndian(1));
+
+			case messagePackBin16:
+				return readBin(_reader.readBigEndian(2));
+
+			case messagePackBin32:
+				return readBin(_reader.readBigEndian(4));
+
+			case messagePackExt8:
+				return readExt(_reader.readBigEndian(1));
+
+			case messagePackExt16:
+				return readExt(_reader.readBigEndian(2));
+
+			case messagePackExt32:
+				return readExt(_reader.readBigEndian(4));
+
+			case messagePackFloat32:
+				return Value(bitsToFloat(static_cast<uint32_t>(_reader.readBigEndian(4))));
+
+			case messagePackFloat64:
+				return Value(bitsToDouble(_reader.readBigEndian(8)));
+
+			case messagePackUint8:
+			case messagePackUint16:
+			case messagePackUint32:
+			case messagePackUint64:
+			{
+				const auto value =
+					_reader.readBigEndian(size_t { 1 } << (format - messagePackUint8));
+
+				if (value > static_cast<uint64_t>(std::numeric_limits<IntType>::max()))
+				{
+					// https://facebook.github.io/graphql/June2018/#sec-Int
+					throw std::overflow_error("GraphQL only supports 32-bit signed integers");
+				}
+
+				return Value(static_cast<IntType>(value));
+			}
+
+			case messagePackInt8:
+				return Value(static_cast<IntType>(static_cast<int8_t>(_reader.readBigEndian(1))));
+
+			case messagePackInt16:
+				return Value(static_cast<IntType>(static_cast<int16_t>(_reader.readBigEndian(2))));
+
+			case messagePackInt32:
+				return Value(static_cast<IntType>(static_cast<int32_t>(_reader.readBigEndian(4))));
+
+			case messagePackInt64:
+				return Value(checkedInt(static_cast<int64_t>(_reader.readBigEndian(8))));
+
+			case messagePackStr8:
+				return Value(readString(_reader.readBigEndian(1)));
+
+			case messagePackStr16:
+				return Value(readString(_reader.readBigEndian(2)));
+
+			case messagePackStr32:
+				return Value(readString(_reader.readBigEndian(4)));
+
+			case messagePackArray16:
+				return readArray(_reader.readBigEndian(2));
+
+			case messagePackArray32:
+				return readArray(_reader.readBigEndian(4));
+
+			case messagePackMap16:
+				return readMap(_reader.readBigEndian(2));
+
+			case messagePackMap32:
+				return readMap(_reader.readBigEndian(4));
+
+			default:
+				if (format >= messagePackFixExt1 && format <= messagePackFixExt16)
+				{
+					return readExt(uint64_t { 1 } << (format - messagePackFixExt1));
+				}
+
+				_reader.fail("unsupported format");
+		}
+	}
+
+	BinaryReader _reader;
+};
+
+std::vector<uint8_t> toMessagePack(const Value& response)
+{
+	return MessagePackWriter().write(response);
+}
+
+Value fromMessagePack(const std::vector<uint8_t>& messagePack)
+{
+	return MessagePackReader(messagePack.data(), messagePack.size()).read();
+}
+
+} /* namespace graphql::response */
@@ -3,63 +3,214 @@
 
 #include "graphqlservice/GraphQLResponse.h"
 
-#include <optional>
+#include <algorithm>
+#include <charconv>
 #include <stdexcept>
+#include <string_view>
 #include <variant>
 
 namespace graphql::response {
 
+// Most response maps only have a few members and they are never looked up by name, so it's
+// cheaper to search them linearly. Once a map grows to this size we start indexing the members.
+constexpr size_t minIndexedMapSize = 16;
+
 // Type::Map
 struct MapData
 {
+	explicit MapData(std::pmr::memory_resource* resource)
+		: resource(resource)
+		, index(resource)
+	{
+	}
+
+	explicit MapData(std::pmr::memory_resource* resource, const MapData& other)
+		: resource(resource)
+		, map(other.map)
+		, index(other.index, resource)
+	{
+	}
+
 	bool operator==(const MapData& rhs) const
 	{
 		return map == rhs.map;
 	}
 
+	MapType::const_iterator find(std::string_view name) const
+	{
+		if (index.empty())
+		{
+			return std::find_if(map.cbegin(), map.cend(), [name](const auto& entry) noexcept {
+				return entry.first == name;
+			});
+		}
+
+		const auto [itr, itrEnd] = index.equal_range(std::hash<std::string_view> {}(name));
+		const auto itrMember = std::find_if(itr, itrEnd, [this, name](const auto& entry) noexcept {
+			return map[entry.second].first == name;
+		});
+
+		return (itrMember == itrEnd ? map.cend() : map.cbegin() + itrMember->second);
+	}
+
+	void emplace_back(std::string&& name, Value&& value)
+	{
+		if (find(name) != map.cend())
+		{
+			throw std::runtime_error("Duplicate Map member");
+		}
+
+		map.emplace_back(std::make_pair(std::move(name), std::move(value)));
+
+		if (!index.empty())
+		{
+			addIndex(map.size() - 1);
+		}
+		else if (map.size() == minIndexedMapSize)
+		{
+			index.reserve(map.capacity());
+
+			for (size_t i = 0; i < map.size(); ++i)
+			{
+				addIndex(i);
+			}
+		}
+	}
+
+	void addIndex(size_t position)
+	{
+		index.insert({ std::hash<std::string_view> {}(map[position].first), position });
+	}
+
+	std::pmr::memory_resource* const resource;
 	MapType map;
-	std::unordered_map<std::string, size_t> members;
+
+	// The index maps the hash of each member name to its position in map, so we don't need to
+	// copy the names. It stays empty until the map has minIndexedMapSize members.
+	std::pmr::unordered_multimap<size_t, size_t> index;
 };
 
 // Type::List
 struct ListData
 {
+	explicit ListData(std::pmr::memory_resource* resource)
+		: resource(resource)
+	{
+	}
+
+	explicit ListData(std::pmr::memory_resource* resource, const ListData& other)
+		: resource(resource)
+		, list(other.list)
+	{
+	}
+
 	bool operator==(const ListData& rhs) const
 	{
 		return list == rhs.list;
 	}
 
+	std::pmr::memory_resource* const resource;
 	ListType list;
 };
 
-// Type::String or Type::EnumValue
-struct StringOrEnumData
+// Type::Scalar
+struct ScalarData
 {
-	bool operator==(const StringOrEnumData& rhs) const
+	explicit ScalarData(std::pmr::memory_resource* resource)
+		: resource(resource)
 	{
-		return string == rhs.string && from_json == rhs.from_json;
 	}
 
-	StringType string;
-	bool from_json = false;
-};
+	explicit ScalarData(std::pmr::memory_resource* resource, ScalarType&& value)
+		: resource(resource)
+		, scalar(std::move(value))
+	{
+	}
+
+	explicit ScalarData(std::pmr::memory_resource* resource, const ScalarData& other)
+		: resource(resource)
+		, scalar(other.scalar)
+	{
+	}
 
-// Type::Scalar
-struct ScalarData
-{
 	bool operator==(const ScalarData& rhs) const
 	{
 		return scalar == rhs.scalar;
 	}
 
+	std::pmr::memory_resource* const resource;
 	ScalarType scalar;
 };
 
-struct TypedData
-	: std::variant<std::optional<MapData>, std::optional<ListData>, std::optional<StringOrEnumData>,
-		  std::optional<ScalarData>, BooleanType, IntType, FloatType>
+using MapNode = std::unique_ptr<MapData, NodeDeleter>;
+using ListNode = std::unique_ptr<ListData, NodeDeleter>;
+using ScalarNode = std::unique_ptr<ScalarData, NodeDeleter>;
+
+thread_local std::pmr::memory_resource* s_currentResource = nullptr;
+
+MemoryResourceScope::MemoryResourceScope(std::pmr::memory_resource* resource) noexcept
+	: _previous(s_currentResource)
 {
-};
+	s_currentResource = resource;
+}
+
+MemoryResourceScope::~MemoryResourceScope()
+{
+	s_currentResource = _previous;
+}
+
+std::pmr::memory_resource* MemoryResourceScope::current() noexcept
+{
+	return s_currentResource ? s_currentResource : std::pmr::get_default_resource();
+}
+
+ValueVisitor::~ValueVisitor() = default;
+
+namespace {
+
+template <class _Data, class... _Args>
+std::unique_ptr<_Data, NodeDeleter> makeNode(_Args&&... args)
+{
+	const auto resource = MemoryResourceScope::current();
+	const auto memory = resource->allocate(sizeof(_Data), alignof(_Data));
+
+	try
+	{
+		return std::unique_ptr<_Data, NodeDeleter>(
+			new (memory) _Data(resource, std::forward<_Args>(args)...));
+	}
+	catch (...)
+	{
+		resource->deallocate(memory, sizeof(_Data), alignof(_Data));
+		throw;
+	}
+}
+
+template <class _Data>
+void freeNode(_Data* data) noexcept
+{
+	const auto resource = data->resource;
+
+	data->~_Data();
+	resource->deallocate(data, sizeof(_Data), alignof(_Data));
+}
+
+} // namespace
+
+void NodeDeleter::operator()(MapData* data) const noexcept
+{
+	freeNode(data);
+}
+
+void NodeDeleter::operator()(ListData* data) const noexcept
+{
+	freeNode(data);
+}
+
+void NodeDeleter::operator()(ScalarData* data) const noexcept
+{
+	freeNode(data);
+}
 
 Value::Value(Type type /*= Type::Null*/)
 	: _type(type)
@@ -67,33 +218,32 @@ Value::Value(Type type /*= Type::Null*/)
 	switch (type)
 	{
 		case Type::Map:
-			_data = std::make_unique<TypedData>(TypedData { std::make_optional<MapData>() });
+			_data = makeNode<MapData>();
 			break;
 
 		case Type::List:
-			_data = std::make_unique<TypedData>(TypedData { std::make_optional<ListData>() });
+			_data = makeNode<ListData>();
 			break;
 
 		case Type::String:
 		case Type::EnumValue:
-			_data =
-				std::make_unique<TypedData>(TypedData { std::make_optional<StringOrEnumData>() });
+			_data = StringType {};
 			break;
 
 		case Type::Scalar:
-			_data = std::make_unique<TypedData>(TypedData { std::make_optional<ScalarData>() });
+			_data = makeNode<ScalarData>();
 			break;
 
 		case Type::Boolean:
-			_data = std::make_unique<TypedData>(TypedData { BooleanType { false } });
+			_data = BooleanType { false };
 			break;
 
 		case Type::Int:
-			_data = std::make_unique<TypedData>(TypedData { IntType { 0 } });
+			_data = IntType { 0 };
 			break;
 
 		case Type::Float:
-			_data = std::make_unique<TypedData>(TypedData { FloatType { 0.0 } });
+			_data = FloatType { 0.0 };
 			break;
 
 		default:
@@ -110,45 +260,81 @@ Value::~Value()
 
 Value::Value(const char* value)
 	: _type(Type::String)
-	, _data(std::make_unique<TypedData>(
-		  TypedData { StringOrEnumData { StringType { value }, false } }))
+	, _data(StringType { value })
 {
 }
 
 Value::Value(StringType&& value)
 	: _type(Type::String)
-	, _data(std::make_unique<TypedData>(TypedData { StringOrEnumData { std::move(value), false } }))
+	, _data(std::move(value))
 {
 }
 
 Value::Value(BooleanType value)
 	: _type(Type::Boolean)
-	, _data(std::make_unique<TypedData>(TypedData { value }))
+	, _data(value)
 {
 }
 
 Value::Value(IntType value)
 	: _type(Type::Int)
-	, _data(std::make_unique<TypedData>(TypedData { value }))
+	, _data(value)
 {
 }
 
 Value::Value(FloatType value)
 	: _type(Type::Float)
-	, _data(std::make_unique<TypedData>(TypedData { value }))
+	, _data(value)
 {
 }
 
 Value::Value(Value&& other) noexcept
 	: _type(other.type())
+	, _fromJson(other._fromJson)
 	, _data(std::move(other._data))
 {
+	other._fromJson = false;
+	other._data = std::monostate {};
 }
 
 Value::Value(const Value& other)
 	: _type(other.type())
-	, _data(std::make_unique<TypedData>(other._data ? *other._data : TypedData {}))
+	, _fromJson(other._fromJson)
 {
+	switch (_type)
+	{
+		case Type::Map:
+			_data = makeNode<MapData>(*std::get<MapNode>(other._data));
+			break;
+
+		case Type::List:
+			_data = makeNode<ListData>(*std::get<ListNode>(other._data));
+			break;
+
+		case Type::Scalar:
+			_data = makeNode<ScalarData>(*std::get<ScalarNode>(other._data));
+			break;
+
+		case Type::String:
+		case Type::EnumValue:
+			_data = std::get<StringType>(other._data);
+			break;
+
+		case Type::Boolean:
+			_data = std::get<BooleanType>(other._data);
+			break;
+
+		case Type::Int:
+			_data = std::get<IntType>(other._data);
+			break;
+
+		case Type::Float:
+			_data = std::get<FloatType>(other._data);
+			break;
+
+		default:
+			break;
+	}
 }
 
 Value& Value::operator=(Value&& rhs) noexcept
@@ -156,7 +342,10 @@ Value& Value::operator=(Value&& rhs) noexcept
 	if (&rhs != this)
 	{
 		const_cast<Type&>(_type) = rhs._type;
+		_fromJson = rhs._fromJson;
 		_data = std::move(rhs._data);
+		rhs._fromJson = false;
+		rhs._data = std::monostate {};
 	}
 
 	return *this;
@@ -169,7 +358,25 @@ bool Value::operator==(const Value& rhs) const noexcept
 		return false;
 	}
 
-	return !_data || *_data == *rhs._data;
+	switch (type())
+	{
+		case Type::Map:
+			return *std::get<MapNode>(_data) == *std::get<MapNode>(rhs._data);
+
+		case Type::List:
+			return *std::get<ListNode>(_data) == *std::get<ListNode>(rhs._data);
+
+		case Type::Scalar:
+			return *std::get<ScalarNode>(_data) == *std::get<ScalarNode>(rhs._data);
+
+		case Type::String:
+		case Type::EnumValue:
+			return _fromJson == rhs._fromJson
+				&& std::get<StringType>(_data) == std::get<StringType>(rhs._data);
+
+		default:
+			return _data == rhs._data;
+	}
 }
 
 bool Value::operator!=(const Value& rhs) const noexcept
@@ -179,20 +386,19 @@ bool Value::operator!=(const Value& rhs) const noexcept
 
 Type Value::type() const noexcept
 {
-	return _data ? _type : Type::Null;
+	return std::holds_alternative<std::monostate>(_data) ? Type::Null : _type;
 }
 
 Value&& Value::from_json() noexcept
 {
-	std::get<std::optional<StringOrEnumData>>(*_data)->from_json = true;
+	_fromJson = true;
 
 	return std::move(*this);
 }
 
 bool Value::maybe_enum() const noexcept
 {
-	return type() == Type::EnumValue
-		|| (type() == Type::String && std::get<std::optional<StringOrEnumData>>(*_data)->from_json);
+	return type() == Type::EnumValue || (type() == Type::String && _fromJson);
 }
 
 void Value::reserve(size_t count)
@@ -201,16 +407,15 @@ void Value::reserve(size_t count)
 	{
 		case Type::Map:
 		{
-			auto& mapData = std::get<std::optional<MapData>>(*_data);
+			auto& mapData = std::get<MapNode>(_data);
 
-			mapData->members.reserve(count);
 			mapData->map.reserve(count);
 			break;
 		}
 
 		case Type::List:
 		{
-			auto& listData = std::get<std::optional<ListData>>(*_data);
+			auto& listData = std::get<ListNode>(_data);
 
 			listData->list.reserve(count);
 			break;
@@ -227,14 +432,14 @@ size_t Value::size() const
 	{
 		case Type::Map:
 		{
-			const auto& mapData = std::get<std::optional<MapData>>(*_data);
+			const auto& mapData = std::get<MapNode>(_data);
 
 			return mapData->map.size();
 		}
 
 		case Type::List:
 		{
-			const auto& listData = std::get<std::optional<ListData>>(*_data);
+			const auto& listData = std::get<ListNode>(_data);
 
 			return listData->list.size();
 		}
@@ -251,15 +456,7 @@ void Value::emplace_back(std::string&& name, Value&& value)
 		throw std::logic_error("Invalid call to Value::emplace_back for MapType");
 	}
 
-	auto& mapData = std::get<std::optional<MapData>>(*_data);
-
-	if (mapData->members.find(name) != mapData->members.cend())
-	{
-		throw std::runtime_error("Duplicate Map member");
-	}
-
-	mapData->members.insert({ name, mapData->map.size() });
-	mapData->map.emplace_back(std::make_pair(std::move(name), std::move(value)));
+	std::get<MapNode>(_data)->emplace_back(std::move(name), std::move(value));
 }
 
 MapType::const_iterator Value::find(const std::string& name) const
@@ -269,15 +466,7 @@ MapType::const_iterator Value::find(const std::string& name) const
 		throw std::logic_error("Invalid call to Value::find for MapType");
 	}
 
-	const auto& mapData = std::get<std::optional<MapData>>(*_data);
-	const auto itr = mapData->members.find(name);
-
-	if (itr == mapData->members.cend())
-	{
-		return mapData->map.cend();
-	}
-
-	return mapData->map.cbegin() + itr->second;
+	return std::get<MapNode>(_data)->find(name);
 }
 
 MapType::const_iterator Value::begin() const
@@ -287,7 +476,7 @@ MapType::const_iterator Value::begin() const
 		throw std::logic_error("Invalid call to Value::end for MapType");
 	}
 
-	return std::get<std::optional<MapData>>(*_data)->map.cbegin();
+	return std::get<MapNode>(_data)->map.cbegin();
 }
 
 MapType::const_iterator Value::end() const
@@ -297,7 +486,7 @@ MapType::const_iterator Value::end() const
 		throw std::logic_error("Invalid call to Value::end for MapType");
 	}
 
-	return std::get<std::optional<MapData>>(*_data)->map.cend();
+	return std::get<MapNode>(_data)->map.cend();
 }
 
 const Value& Value::operator[](const std::string& name) const
@@ -319,7 +508,7 @@ void Value::emplace_back(Value&& value)
 		throw std::logic_error("Invalid call to Value::emplace_back for ListType");
 	}
 
-	std::get<std::optional<ListData>>(*_data)->list.emplace_back(std::move(value));
+	std::get<ListNode>(_data)->list.emplace_back(std::move(value));
 }
 
 const Value& Value::operator[](size_t index) const
@@ -329,7 +518,72 @@ const Value& Value::operator[](size_t index) const
 		throw std::logic_error("Invalid call to Value::emplace_back for ListType");
 	}
 
-	return std::get<std::optional<ListData>>(*_data)->list.at(index);
+	return std::get<ListNode>(_data)->list.at(index);
+}
+
+void Value::visit(ValueVisitor& visitor) const
+{
+	switch (type())
+	{
+		case Type::Map:
+		{
+			const auto& map = std::get<MapNode>(_data)->map;
+
+			visitor.startMap(map.size());
+
+			for (const auto& entry : map)
+			{
+				visitor.addMember(entry.first);
+				entry.second.visit(visitor);
+			}
+
+			visitor.endMap();
+			break;
+		}
+
+		case Type::List:
+		{
+			const auto& list = std::get<ListNode>(_data)->list;
+
+			visitor.startList(list.size());
+
+			for (const auto& entry : list)
+			{
+				entry.visit(visitor);
+			}
+
+			visitor.endList();
+			break;
+		}
+
+		case Type::String:
+			visitor.addString(std::get<StringType>(_data));
+			break;
+
+		case Type::EnumValue:
+			visitor.addEnum(std::get<StringType>(_data));
+			break;
+
+		case Type::Null:
+			visitor.addNull();
+			break;
+
+		case Type::Boolean:
+			visitor.addBool(std::get<BooleanType>(_data));
+			break;
+
+		case Type::Int:
+			visitor.addInt(std::get<IntType>(_data));
+			break;
+
+		case Type::Float:
+			visitor.addFloat(std::get<FloatType>(_data));
+			break;
+
+		case Type::Scalar:
+			std::get<ScalarNode>(_data)->scalar.visit(visitor);
+			break;
+	}
 }
 
 template <>
@@ -340,7 +594,7 @@ void Value::set<StringType>(StringType&& value)
 		throw std::logic_error("Invalid call to Value::set for StringType");
 	}
 
-	std::get<std::optional<StringOrEnumData>>(*_data)->string = std::move(value);
+	std::get<StringType>(_data) = std::move(value);
 }
 
 template <>
@@ -351,7 +605,7 @@ void Value::set<BooleanType>(BooleanType value)
 		throw std::logic_error("Invalid call to Value::set for BooleanType");
 	}
 
-	*_data = { value };
+	_data = value;
 }
 
 template <>
@@ -360,7 +614,7 @@ void Value::set<IntType>(IntType value)
 	if (type() == Type::Float)
 	{
 		// Coerce IntType to FloatType
-		*_data = { static_cast<FloatType>(value) };
+		_data = static_cast<FloatType>(value);
 	}
 	else
 	{
@@ -369,7 +623,7 @@ void Value::set<IntType>(IntType value)
 			throw std::logic_error("Invalid call to Value::set for IntType");
 		}
 
-		*_data = { value };
+		_data = value;
 	}
 }
 
@@ -381,7 +635,7 @@ void Value::set<FloatType>(FloatType value)
 		throw std::logic_error("Invalid call to Value::set for FloatType");
 	}
 
-	*_data = { value };
+	_data = value;
 }
 
 template <>
@@ -392,7 +646,7 @@ void Value::set<ScalarType>(ScalarType&& value)
 		throw std::logic_error("Invalid call to Value::set for ScalarType");
 	}
 
-	*_data = { ScalarData { std::move(value) } };
+	_data = makeNode<ScalarData>(std::move(value));
 }
 
 template <>
@@ -403,7 +657,7 @@ const MapType& Value::get<MapType>() const
 		throw std::logic_error("Invalid call to Value::get for MapType");
 	}
 
-	return std::get<std::optional<MapData>>(*_data)->map;
+	return std::get<MapNode>(_data)->map;
 }
 
 template <>
@@ -414,7 +668,7 @@ const ListType& Value::get<ListType>() const
 		throw std::logic_error("Invalid call to Value::get for ListType");
 	}
 
-	return std::get<std::optional<ListData>>(*_data)->list;
+	return std::get<ListNode>(_data)->list;
 }
 
 template <>
@@ -425,7 +679,7 @@ const StringType& Value::get<StringType>() const
 		throw std::logic_error("Invalid call to Value::get for StringType");
 	}
 
-	return std::get<std::optional<StringOrEnumData>>(*_data)->string;
+	return std::get<StringType>(_data);
 }
 
 template <>
@@ -436,7 +690,7 @@ BooleanType Value::get<BooleanType>() const
 		throw std::logic_error("Invalid call to Value::get for BooleanType");
 	}
 
-	return std::get<BooleanType>(*_data);
+	return std::get<BooleanType>(_data);
 }
 
 template <>
@@ -447,7 +701,7 @@ IntType Value::get<IntType>() const
 		throw std::logic_error("Invalid call to Value::get for IntType");
 	}
 
-	return std::get<IntType>(*_data);
+	return std::get<IntType>(_data);
 }
 
 template <>
@@ -456,7 +710,7 @@ FloatType Value::get<FloatType>() const
 	if (type() == Type::Int)
 	{
 		// Coerce IntType to FloatType
-		return static_cast<FloatType>(std::get<IntType>(*_data));
+		return static_cast<FloatType>(std::get<IntType>(_data));
 	}
 
 	if (type() != Type::Float)
@@ -464,7 +718,7 @@ FloatType Value::get<FloatType>() const
 		throw std::logic_error("Invalid call to Value::get for FloatType");
 	}
 
-	return std::get<FloatType>(*_data);
+	return std::get<FloatType>(_data);
 }
 
 template <>
@@ -475,7 +729,7 @@ const ScalarType& Value::get<ScalarType>() const
 		throw std::logic_error("Invalid call to Value::get for ScalarType");
 	}
 
-	return std::get<std::optional<ScalarData>>(*_data)->scalar;
+	return std::get<ScalarNode>(_data)->scalar;
 }
 
 template <>
@@ -486,10 +740,10 @@ MapType Value::release<MapType>()
 		throw std::logic_error("Invalid call to Value::release for MapType");
 	}
 
-	auto& mapData = std::get<std::optional<MapData>>(*_data);
+	auto& mapData = std::get<MapNode>(_data);
 	MapType result = std::move(mapData->map);
 
-	mapData->members.clear();
+	mapData->index.clear();
 
 	return result;
 }
@@ -502,7 +756,7 @@ ListType Value::release<ListType>()
 		throw std::logic_error("Invalid call to Value::release for ListType");
 	}
 
-	ListType result = std::move(std::get<std::optional<ListData>>(*_data)->list);
+	ListType result = std::move(std::get<ListNode>(_data)->list);
 
 	return result;
 }
@@ -515,10 +769,9 @@ StringType Value::release<StringType>()
 		throw std::logic_error("Invalid call to Value::release for StringType");
 	}
 
-	auto& stringData = std::get<std::optional<StringOrEnumData>>(*_data);
-	StringType result = std::move(stringData->string);
+	StringType result = std::move(std::get<StringType>(_data));
 
-	stringData->from_json = false;
+	_fromJson = false;
 
 	return result;
 }
@@ -531,9 +784,515 @@ ScalarType Value::release<ScalarType>()
 		throw std::logic_error("Invalid call to Value::release for ScalarType");
 	}
 
-	ScalarType result = std::move(std::get<std::optional<ScalarData>>(*_data)->scalar);
+	ScalarType result = std::move(std::get<ScalarNode>(_data)->scalar);
 
 	return result;
 }
 
+namespace {
+
+using namespace std::literals;
+
+constexpr std::string_view strOp { "op"sv };
+constexpr std::string_view strPath { "path"sv };
+constexpr std::string_view strValue { "value"sv };
+constexpr std::string_view strAdd { "add"sv };
+constexpr std::string_view strRemove { "remove"sv };
+constexpr std::string_view strReplace { "replace"sv };
+
+// Append a reference token to a JSON Pointer (RFC 6901).
+void appendPointer(std::string& path, std::string_view token)
+{
+	path.push_back('/');
+
+	for (const auto ch : token)
+	{
+		switch (ch)
+		{
+			case '~':
+				path.append("~0");
+				break;
+
+			case '/':
+				path.append("~1");
+				break;
+
+			default:
+				path.push_back(ch);
+				break;
+		}
+	}
+}
+
+void addPatchOperation(
+	Value& patch, std::string_view op, const std::string& path, const Value* value = nullptr)
+{
+	Value operation(Type::Map);
+
+	operation.reserve(value ? 3 : 2);
+	operation.emplace_back(std::string { strOp }, Value(std::string { op }));
+	operation.emplace_back(std::string { strPath }, Value(std::string { path }));
+
+	if (value)
+	{
+		operation.emplace_back(std::string { strValue }, Value(*value));
+	}
+
+	patch.emplace_back(std::move(operation));
+}
+
+void diffValues(const Value& from, const Value& to, std::string& path, Value& patch)
+{
+	if (from.type() != to.type())
+	{
+		addPatchOperation(patch, strReplace, path, &to);
+		return;
+	}
+
+	const auto length = path.size();
+
+	switch (to.type())
+	{
+		case Type::Map:
+		{
+			for (const auto& entry : to)
+			{
+				auto itr = from.find(entry.first);
+
+				appendPointer(path, entry.first);
+
+				if (itr == from.end())
+				{
+					addPatchOperation(patch, strAdd, path, &entry.second);
+				}
+				else
+				{
+					diffValues(itr->second, entry.second, path, patch);
+				}
+
+				path.resize(length);
+			}
+
+			for (const auto& entry : from)
+			{
+				if (to.find(entry.first) == to.end())
+				{
+					appendPointer(path, entry.first);
+					addPatchOperation(patch, strRemove, path);
+					path.resize(length);
+				}
+			}
+
+			break;
+		}
+
+		case Type::List:
+		{
+			const auto& fromList = from.get<ListType>();
+			const auto& toList = to.get<ListType>();
+			const auto common = std::min(fromList.size(), toList.size());
+
+			for (size_t i = 0; i < toList.size(); ++i)
+			{
+				appendPointer(path, std::to_string(i));
+
+				if (i < common)
+				{
+					diffValues(fromList[i], toList[i], path, patch);
+				}
+				else
+				{
+					addPatchOperation(patch, strAdd, path, &toList[i]);
+				}
+
+				path.resize(length);
+			}
+
+			// Remove the extra entries from the end, so the indices don't shift.
+			for (size_t i = fromList.size(); i > common; --i)
+			{
+				appendPointer(path, std::to_string(i - 1));
+				addPatchOperation(patch, strRemove, path);
+				path.resize(length);
+			}
+
+			break;
+		}
+
+		default:
+			if (from != to)
+			{
+				addPatchOperation(patch, strReplace, path, &to);
+			}
+			break;
+	}
+}
+
+// Split a JSON Pointer into its unescaped reference tokens.
+std::vector<std::string> parsePointer(std::string_view path)
+{
+	std::vector<std::string> tokens;
+
+	if (path.empty())
+	{
+		return tokens;
+	}
+
+	if (path.front() != '/')
+	{
+		throw std::runtime_error("Invalid patch path");
+	}
+
+	for (size_t i = 0; i < path.size(); ++i)
+	{
+		if (path[i] == '/')
+		{
+			tokens.emplace_back();
+		}
+		else if (path[i] == '~')
+		{
+			// RFC 6901 only defines the ~0 and ~1 escape sequences.
+			if (i + 1 == path.size() || (path[i + 1] != '0' && path[i + 1] != '1'))
+			{
+				throw std::runtime_error("Invalid patch path");
+			}
+
+			tokens.back().push_back(path[++i] == '0' ? '~' : '/');
+		}
+		else
+		{
+			tokens.back().push_back(path[i]);
+		}
+	}
+
+	return tokens;
+}
+
+size_t parseIndex(const std::string& token, size_t size)
+{
+	if (token == "-")
+	{
+		return size;
+	}
+
+	const auto first = token.data();
+	const auto last = first + token.size();
+	size_t index = 0;
+
+	// RFC 6901 doesn't allow leading zeroes in an array index.
+	if (token.empty() || (token.size() > 1 && token.front() == '0')
+		|| std::find_if_not(first, last, [](char c) noexcept {
+			   return c >= '0' && c <= '9';
+		   }) != last
+		|| std::from_chars(first, last, index).ec != std::errc {})
+	{
+		throw std::runtime_error("Invalid patch path");
+	}
+
+	return index;
+}
+
+} // namespace
+
+// Value doesn't expose mutable access to the members of a Map or List, so this is a friend of
+// Value which modifies them in place.
+struct PatchOperation
+{
+	// Everything applyPatch needs to reverse one operation if a later one fails. The Map and List
+	// nodes don't move when the Value which owns them does, and anything an operation removes or
+	// replaces is kept alive in previous, so they stay valid until the operations are reversed.
+	// An entry without a map or list replaced the whole document.
+	struct Undo
+	{
+		enum class Action
+		{
+			Erase,
+			Insert,
+			Restore,
+		};
+
+		Action action;
+		MapData* map;
+		ListData* list;
+		size_t position;
+		std::string name;
+		Value previous;
+	};
+
+	static Value& child(Value& target, const std::string& token)
+	{
+		switch (target.type())
+		{
+			case Type::Map:
+			{
+				auto& data = *std::get<std::unique_ptr<MapData, NodeDeleter>>(target._data);
+				const auto itr = data.find(token);
+
+				if (itr == data.map.cend())
+				{
+					throw std::runtime_error("Invalid patch path");
+				}
+
+				return data.map[static_cast<size_t>(itr - data.map.cbegin())].second;
+			}
+
+			case Type::List:
+			{
+				auto& list = std::get<std::unique_ptr<ListData, NodeDeleter>>(target._data)->list;
+				const auto index = parseIndex(token, list.size());
+
+				if (index >= list.size())
+				{
+					throw std::runtime_error("Invalid patch path");
+				}
+
+				return list[index];
+			}
+
+			default:
+				throw std::runtime_error("Invalid patch path");
+		}
+	}
+
+	// Every check happens before anything is modified, so target is unchanged if this throws. The
+	// caller reserves room in undo for every operation, so adding the entry can't throw either.
+	static void apply(Value& target, const std::string& token, std::string_view op,
+		const Value* value, std::vector<Undo>& undo)
+	{
+		switch (target.type())
+		{
+			case Type::Map:
+			{
+				auto& data = *std::get<std::unique_ptr<MapData, NodeDeleter>>(target._data);
+				const auto itr = data.find(token);
+
+				if (itr == data.map.cend())
+				{
+					// RFC 6902 only allows "add" to create a new member.
+					if (op != strAdd)
+					{
+						throw std::runtime_error("Invalid patch path");
+					}
+
+					data.emplace_back(std::string { token }, Value(*value));
+					undo.push_back({ Undo::Action::Erase, &data, nullptr, data.map.size() - 1 });
+					break;
+				}
+
+				const auto position = static_cast<size_t>(itr - data.map.cbegin());
+				auto& member = data.map[position];
+
+				if (op == strRemove)
+				{
+					undo.push_back({ Undo::Action::Insert,
+						&data,
+						nullptr,
+						position,
+						std::move(member.first),
+						std::move(member.second) });
+					data.map.erase(itr);
+					rebuildIndex(data);
+				}
+				else
+				{
+					Value replacement(*value);
+
+					undo.push_back({ Undo::Action::Restore,
+						&data,
+						nullptr,
+						position,
+						{},
+						std::move(member.second) });
+					member.second = std::move(replacement);
+				}
+
+				break;
+			}
+
+			case Type::List:
+			{
+				auto& data = *std::get<std::unique_ptr<ListData, NodeDeleter>>(target._data);
+				auto& list = data.list;
+				const auto index = parseIndex(token, list.size());
+
+				if (op == strAdd)
+				{
+					if (index > list.size())
+					{
+						throw std::runtime_error("Invalid patch path");
+					}
+
+					list.emplace(list.begin() + index, Value(*value));
+					undo.push_back({ Undo::Action::Erase, nullptr, &data, index });
+				}
+				else if (index >= list.size())
+				{
+					throw std::runtime_error("Invalid patch path");
+				}
+				else if (op == strRemove)
+				{
+					undo.push_back(
+						{ Undo::Action::Insert, nullptr, &data, index, {}, std::move(list[index]) });
+					list.erase(list.begin() + index);
+				}
+				else
+				{
+					Value replacement(*value);
+
+					undo.push_back({ Undo::Action::Restore,
+						nullptr,
+						&data,
+						index,
+						{},
+						std::move(list[index]) });
+					list[index] = std::move(replacement);
+				}
+
+				break;
+			}
+
+			default:
+				throw std::runtime_error("Invalid patch path");
+		}
+	}
+
+	// Reverse the operations in the opposite order they were applied.
+	static void revert(Value& document, std::vector<Undo>& undo)
+	{
+		for (auto itr = undo.rbegin(); itr != undo.rend(); ++itr)
+		{
+			if (itr->map)
+			{
+				auto& map = itr->map->map;
+
+				switch (itr->action)
+				{
+					case Undo::Action::Erase:
+						map.erase(map.begin() + itr->position);
+						rebuildIndex(*itr->map);
+						break;
+
+					case Undo::Action::Insert:
+						map.emplace(map.begin() + itr->position,
+							std::make_pair(std::move(itr->name), std::move(itr->previous)));
+						rebuildIndex(*itr->map);
+						break;
+
+					case Undo::Action::Restore:
+						map[itr->position].second = std::move(itr->previous);
+						break;
+				}
+			}
+			else if (itr->list)
+			{
+				auto& list = itr->list->list;
+
+				switch (itr->action)
+				{
+					case Undo::Action::Erase:
+						list.erase(list.begin() + itr->position);
+						break;
+
+					case Undo::Action::Insert:
+						list.emplace(list.begin() + itr->position, std::move(itr->previous));
+						break;
+
+					case Undo::Action::Restore:
+						list[itr->position] = std::move(itr->previous);
+						break;
+				}
+			}
+			else
+			{
+				document = std::move(itr->previous);
+			}
+		}
+	}
+
+	// Positions after an inserted or removed member have shifted, so rebuild the whole index.
+	static void rebuildIndex(MapData& data)
+	{
+		data.index.clear();
+
+		if (data.map.size() >= minIndexedMapSize)
+		{
+			for (size_t i = 0; i < data.map.size(); ++i)
+			{
+				data.addIndex(i);
+			}
+		}
+	}
+};
+
+Value makePatch(const Value& from, const Value& to)
+{
+	Value patch(Type::List);
+	std::string path;
+
+	diffValues(from, to, path, patch);
+
+	return patch;
+}
+
+void applyPatch(Value& document, const Value& patch)
+{
+	const auto& operations = patch.get<ListType>();
+	std::vector<PatchOperation::Undo> undo;
+
+	// Apply the operations in place, and reverse the ones which succeeded if any of them fail, so
+	// document is unchanged after an error.
+	undo.reserve(operations.size());
+
+	try
+	{
+		for (const auto& operation : operations)
+		{
+			const auto& op = operation[std::string { strOp }].get<StringType>();
+			const auto tokens = parsePointer(operation[std::string { strPath }].get<StringType>());
+			const Value* value = nullptr;
+
+			if (op != strAdd && op != strRemove && op != strReplace)
+			{
+				throw std::runtime_error("Unsupported patch operation");
+			}
+			else if (op != strRemove)
+			{
+				value = &operation[std::string { strValue }];
+			}
+			else if (tokens.empty())
+			{
+				throw std::runtime_error("Invalid patch path");
+			}
+
+			if (tokens.empty())
+			{
+				Value replacement(*value);
+
+				undo.push_back({ PatchOperation::Undo::Action::Restore,
+					nullptr,
+					nullptr,
+					0,
+					{},
+					std::move(document) });
+				document = std::move(replacement);
+				continue;
+			}
+
+			Value* target = &document;
+
+			for (size_t i = 0; i + 1 < tokens.size(); ++i)
+			{
+				target = &PatchOperation::child(*target, tokens[i]);
+			}
+
+			PatchOperation::apply(*target, tokens.back(), op, value, undo);
+		}
+	}
+	catch (...)
+	{
+		PatchOperation::revert(document, undo);
+		throw;
+	}
+}
+
 } /* namespace graphql::response */
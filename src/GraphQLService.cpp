@@ -8,6 +8,8 @@
 
 #include <algorithm>
 #include <array>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
 #include <stack>
 
@@ -159,6 +161,60 @@ response::Value schema_exception::getErrors() noexcept
 	return errors;
 }
 
+SelectionCounter::SelectionCounter(size_t maxSelections) noexcept
+	: _maxSelections(maxSelections)
+{
+}
+
+bool SelectionCounter::increment() noexcept
+{
+	return ++_count <= _maxSelections;
+}
+
+size_t SelectionCounter::getMaxSelections() const noexcept
+{
+	return _maxSelections;
+}
+
+CacheControl::CacheControl() noexcept
+	: _maxAge(std::chrono::seconds::max().count())
+{
+}
+
+void CacheControl::hint(std::chrono::seconds maxAge, bool rootField) noexcept
+{
+	auto current = _maxAge.load();
+
+	while (maxAge.count() < current && !_maxAge.compare_exchange_weak(current, maxAge.count()))
+	{
+	}
+
+	if (rootField)
+	{
+		++_hintedRootFields;
+	}
+}
+
+void CacheControl::addRootField() noexcept
+{
+	++_rootFields;
+}
+
+void CacheControl::disable() noexcept
+{
+	_maxAge = 0;
+}
+
+std::chrono::seconds CacheControl::getMaxAge() const noexcept
+{
+	if (_hintedRootFields < _rootFields)
+	{
+		return std::chrono::seconds { 0 };
+	}
+
+	return std::chrono::seconds { _maxAge.load() };
+}
+
 FieldParams::FieldParams(const SelectionSetParams& selectionSetParams, response::Value&& directives)
 	: SelectionSetParams(selectionSetParams)
 	, fieldDirectives(std::move(directives))
@@ -512,6 +568,14 @@ schema_location ResolverParams::getLocation() const
 	return { position.line, position.column };
 }
 
+void ResolverParams::hintCacheMaxAge(std::chrono::seconds maxAge) const noexcept
+{
+	if (cacheControl)
+	{
+		cacheControl->hint(maxAge, errorPath.size() == 1);
+	}
+}
+
 uint8_t Base64::verifyFromBase64(char ch)
 {
 	uint8_t result = fromBase64(ch);
@@ -898,6 +962,8 @@ private:
 	const response::Value& _operationDirectives;
 	const field_path _path;
 	const std::launch _launch;
+	const std::shared_ptr<SelectionCounter>& _selectionCounter;
+	const std::shared_ptr<CacheControl>& _cacheControl;
 	const FragmentMap& _fragments;
 	const response::Value& _variables;
 	const TypeNames& _typeNames;
@@ -916,6 +982,8 @@ SelectionVisitor::SelectionVisitor(const SelectionSetParams& selectionSetParams,
 	, _operationDirectives(selectionSetParams.operationDirectives)
 	, _path(selectionSetParams.errorPath)
 	, _launch(selectionSetParams.launch)
+	, _selectionCounter(selectionSetParams.selectionCounter)
+	, _cacheControl(selectionSetParams.cacheControl)
 	, _fragments(fragments)
 	, _variables(variables)
 	, _typeNames(typeNames)
@@ -935,6 +1003,18 @@ std::queue<std::pair<std::string, std::future<response::Value>>> SelectionVisito
 
 void SelectionVisitor::visit(const peg::ast_node& selection)
 {
+	if (_selectionCounter && !_selectionCounter->increment())
+	{
+		auto position = selection.begin();
+		std::ostringstream error;
+
+		error << "Too many selections max: " << _selectionCounter->getMaxSelections();
+
+		throw schema_exception {
+			{ schema_error { error.str(), { position.line, position.column }, { _path } } }
+		};
+	}
+
 	if (selection.is_type<peg::field>())
 	{
 		visitField(selection);
@@ -1041,8 +1121,15 @@ void SelectionVisitor::visitField(const peg::ast_node& field)
 		_fragmentDirectives.top().inlineFragmentDirectives,
 		std::move(path),
 		_launch,
+		_selectionCounter,
+		_cacheControl,
 	};
 
+	if (_cacheControl && _path.empty())
+	{
+		_cacheControl->addRootField();
+	}
+
 	try
 	{
 		auto result = itr->second(ResolverParams(selectionSetParams,
@@ -1402,6 +1489,37 @@ void FragmentDefinitionVisitor::visit(const peg::ast_node& fragmentDefinition)
 		Fragment(fragmentDefinition, _variables) });
 }
 
+std::shared_ptr<Object> EntityCache::find(
+	std::string_view typeName, const response::IdType& id) const
+{
+	std::shared_lock lock(_mutex);
+	const auto itr = _entities.find({ std::string { typeName }, id });
+
+	return (itr == _entities.cend() ? nullptr : itr->second);
+}
+
+void EntityCache::insert(
+	std::string_view typeName, const response::IdType& id, std::shared_ptr<Object> entity)
+{
+	std::unique_lock lock(_mutex);
+
+	_entities[{ std::string { typeName }, id }] = std::move(entity);
+}
+
+void EntityCache::invalidate(std::string_view typeName, const response::IdType& id)
+{
+	std::unique_lock lock(_mutex);
+
+	_entities.erase({ std::string { typeName }, id });
+}
+
+void EntityCache::clear()
+{
+	std::unique_lock lock(_mutex);
+
+	_entities.clear();
+}
+
 // OperationDefinitionVisitor visits the AST and executes the one with the specified
 // operation name.
 class OperationDefinitionVisitor
@@ -1409,7 +1527,8 @@ class OperationDefinitionVisitor
 public:
 	OperationDefinitionVisitor(ResolverContext resolverContext, std::launch launch,
 		std::shared_ptr<RequestState> state, const TypeMap& operations, response::Value&& variables,
-		FragmentMap&& fragments);
+		FragmentMap&& fragments, std::shared_ptr<SelectionCounter> selectionCounter,
+		std::shared_ptr<CacheControl> cacheControl);
 
 	std::future<response::Value> getValue();
 
@@ -1420,17 +1539,22 @@ private:
 	const std::launch _launch;
 	std::shared_ptr<OperationData> _params;
 	const TypeMap& _operations;
+	std::shared_ptr<SelectionCounter> _selectionCounter;
+	std::shared_ptr<CacheControl> _cacheControl;
 	std::future<response::Value> _result;
 };
 
 OperationDefinitionVisitor::OperationDefinitionVisitor(ResolverContext resolverContext,
 	std::launch launch, std::shared_ptr<RequestState> state, const TypeMap& operations,
-	response::Value&& variables, FragmentMap&& fragments)
+	response::Value&& variables, FragmentMap&& fragments,
+	std::shared_ptr<SelectionCounter> selectionCounter, std::shared_ptr<CacheControl> cacheControl)
 	: _resolverContext(resolverContext)
 	, _launch(launch)
 	, _params(std::make_shared<OperationData>(
 		  std::move(state), std::move(variables), response::Value(), std::move(fragments)))
 	, _operations(operations)
+	, _selectionCounter(std::move(selectionCounter))
+	, _cacheControl(std::move(cacheControl))
 {
 }
 
@@ -1499,6 +1623,8 @@ void OperationDefinitionVisitor::visit(
 		_launch,
 		[selectionContext = _resolverContext,
 			selectionLaunch = _launch,
+			selectionCounter = std::move(_selectionCounter),
+			cacheControl = std::move(_cacheControl),
 			params = std::move(_params),
 			operation = itr->second](const peg::ast_node& selection) {
 			// The top level object doesn't come from inside of a fragment, so all of the fragment
@@ -1513,11 +1639,27 @@ void OperationDefinitionVisitor::visit(
 				emptyFragmentDirectives,
 				{},
 				selectionLaunch,
+				selectionCounter,
+				cacheControl,
 			};
 
-			return operation
-				->resolve(selectionSetParams, selection, params->fragments, params->variables)
-				.get();
+			try
+			{
+				return operation
+					->resolve(selectionSetParams, selection, params->fragments, params->variables)
+					.get();
+			}
+			catch (schema_exception& ex)
+			{
+				// Errors while expanding the top level selection set, e.g. exceeding the
+				// selection limit, fail the entire operation.
+				response::Value document(response::Type::Map);
+
+				document.emplace_back(std::string { strData }, response::Value());
+				document.emplace_back(std::string { strErrors }, ex.getErrors());
+
+				return document;
+			}
 		},
 		std::cref(*operationDefinition.children.back()));
 }
@@ -1762,13 +1904,18 @@ Request::Request(TypeMap&& operationTypes)
 {
 }
 
-std::vector<schema_error> Request::validate(peg::ast& query) const
+std::vector<schema_error> Request::validate(const peg::ast& query) const
+{
+	return validate(query, std::numeric_limits<size_t>::max());
+}
+
+std::vector<schema_error> Request::validate(const peg::ast& query, size_t maxErrors) const
 {
 	std::vector<schema_error> errors;
 
 	if (!query.validated)
 	{
-		ValidateExecutableVisitor visitor(*this);
+		ValidateExecutableVisitor visitor(*this, maxErrors);
 
 		visitor.visit(*query.root);
 
@@ -1779,6 +1926,74 @@ std::vector<schema_error> Request::validate(peg::ast& query) const
 	return errors;
 }
 
+void Request::setMaxSelections(size_t maxSelections) noexcept
+{
+	_maxSelections = maxSelections;
+}
+
+size_t Request::getMaxSelections() const noexcept
+{
+	return _maxSelections;
+}
+
+void Request::setGroupSubscriptions(bool groupSubscriptions) noexcept
+{
+	_groupSubscriptions = groupSubscriptions;
+}
+
+bool Request::getGroupSubscriptions() const noexcept
+{
+	return _groupSubscriptions;
+}
+
+void Request::setDeliveryShards(size_t deliveryShards) noexcept
+{
+	_deliveryShards = std::max<size_t>(1, deliveryShards);
+}
+
+size_t Request::getDeliveryShards() const noexcept
+{
+	return _deliveryShards;
+}
+
+void Request::setSubscriptionSerializer(ResponseSerializer&& serialize)
+{
+	_subscriptionSerializer = std::move(serialize);
+}
+
+void Request::setSubscriptionFilterKey(
+	const SubscriptionName& field, SubscriptionFilterKeyCallback&& makeFilterKey)
+{
+	if (!makeFilterKey)
+	{
+		_subscriptionFilterKeys.erase(field);
+		return;
+	}
+
+	_subscriptionFilterKeys[field] = std::move(makeFilterKey);
+}
+
+void Request::setSubscriptionClock(SubscriptionClock&& clock)
+{
+	_subscriptionClock = std::move(clock);
+}
+
+std::chrono::steady_clock::time_point Request::getSubscriptionTime() const
+{
+	return _subscriptionClock ? _subscriptionClock() : std::chrono::steady_clock::now();
+}
+
+// The parsed and validated document which is shared by every subscription with the same text.
+struct SubscriptionDocument
+{
+	peg::ast query;
+};
+
+std::shared_ptr<SelectionCounter> Request::makeSelectionCounter() const
+{
+	return (_maxSelections > 0 ? std::make_shared<SelectionCounter>(_maxSelections) : nullptr);
+}
+
 std::pair<std::string, const peg::ast_node*> Request::findOperationDefinition(
 	const peg::ast_node& root, const std::string& operationName) const
 {
@@ -1889,14 +2104,14 @@ std::future<response::Value> Request::resolve(std::launch launch,
 }
 
 std::future<response::Value> Request::resolve(const std::shared_ptr<RequestState>& state,
-	peg::ast& query, const std::string& operationName, response::Value&& variables) const
+	const peg::ast& query, const std::string& operationName, response::Value&& variables) const
 {
 	return resolve(std::launch::deferred, state, query, operationName, std::move(variables));
 }
 
 std::future<response::Value> Request::resolve(std::launch launch,
-	const std::shared_ptr<RequestState>& state, peg::ast& query, const std::string& operationName,
-	response::Value&& variables) const
+	const std::shared_ptr<RequestState>& state, const peg::ast& query,
+	const std::string& operationName, response::Value&& variables) const
 {
 	auto errors = validate(query);
 
@@ -1917,7 +2132,8 @@ std::future<response::Value> Request::resolve(std::launch launch,
 
 std::future<response::Value> Request::resolveValidated(std::launch launch,
 	const std::shared_ptr<RequestState>& state, const peg::ast_node& root,
-	const std::string& operationName, response::Value&& variables) const
+	const std::string& operationName, response::Value&& variables,
+	const std::shared_ptr<CacheControl>& cacheControl /*= {}*/) const
 {
 	try
 	{
@@ -1985,6 +2201,11 @@ std::future<response::Value> Request::resolveValidated(std::launch launch,
 		{
 			// Force mutations to perform serial execution
 			launch = std::launch::deferred;
+
+			if (cacheControl)
+			{
+				cacheControl->disable();
+			}
 		}
 
 		const auto resolverContext =
@@ -1995,7 +2216,9 @@ std::future<response::Value> Request::resolveValidated(std::launch launch,
 			state,
 			_operations,
 			std::move(variables),
-			std::move(fragments));
+			std::move(fragments),
+			makeSelectionCounter(),
+			cacheControl);
 
 		operationVisitor.visit(operationDefinition.first, *operationDefinition.second);
 
@@ -2014,376 +2237,1726 @@ std::future<response::Value> Request::resolveValidated(std::launch launch,
 	}
 }
 
-SubscriptionKey Request::subscribe(SubscriptionParams&& params, SubscriptionCallback&& callback)
+bool ResponseCache::Key::operator==(const Key& rhs) const noexcept
 {
-	auto errors = validate(params.query);
+	return document == rhs.document && operationName == rhs.operationName
+		&& variables == rhs.variables && scope == rhs.scope;
+}
 
-	if (!errors.empty())
+size_t ResponseCache::KeyHash::operator()(const Key& key) const noexcept
+{
+	const std::hash<std::string> hash;
+	size_t result = hash(key.document);
+
+	for (const auto& value : { &key.operationName, &key.variables, &key.scope })
 	{
-		throw schema_exception { std::move(errors) };
+		result ^= hash(*value) + 0x9e3779b9 + (result << 6) + (result >> 2);
 	}
 
-	FragmentDefinitionVisitor fragmentVisitor(params.variables);
+	return result;
+}
 
-	peg::for_each_child<peg::fragment_definition>(*params.query.root,
-		[&fragmentVisitor](const peg::ast_node& child) {
-			fragmentVisitor.visit(child);
-		});
+ResponseCache::ResponseCache(ResponseSerializer&& serialize, size_t maxEntries /*= 1024*/)
+	: _serialize(std::move(serialize))
+	, _maxEntries(maxEntries)
+{
+}
 
-	auto fragments = fragmentVisitor.getFragments();
-	auto operationDefinition = findOperationDefinition(*params.query.root, params.operationName);
+std::string ResponseCache::serialize(response::Value&& document) const
+{
+	return _serialize(std::move(document));
+}
 
-	if (!operationDefinition.second)
+std::shared_ptr<const std::string> ResponseCache::find(const Key& key)
+{
+	std::lock_guard lock(_mutex);
+	const auto itr = _entries.find(key);
+
+	if (itr == _entries.end())
 	{
-		std::ostringstream message;
+		return nullptr;
+	}
 
-		message << "Missing subscription";
+	if (itr->second.expiration <= Clock::now())
+	{
+		_entries.erase(itr);
+		return nullptr;
+	}
 
-		if (!params.operationName.empty())
-		{
-			message << " name: " << params.operationName;
-		}
+	return itr->second.response;
+}
 
-		throw schema_exception { { message.str() } };
-	}
-	else if (operationDefinition.first != strSubscription)
+void ResponseCache::insert(
+	Key&& key, std::shared_ptr<const std::string> response, std::chrono::seconds maxAge)
+{
+	const auto now = Clock::now();
+	std::lock_guard lock(_mutex);
+
+	if (_entries.size() >= _maxEntries && _entries.find(key) == _entries.end())
 	{
-		auto position = operationDefinition.second->begin();
-		std::ostringstream message;
+		// Make room by dropping the expired entries, or the one which will expire soonest.
+		auto soonest = _entries.end();
 
-		message << "Unexpected operation type: " << operationDefinition.first;
+		for (auto itr = _entries.begin(); itr != _entries.end();)
+		{
+			if (itr->second.expiration <= now)
+			{
+				itr = _entries.erase(itr);
+				continue;
+			}
 
-		if (!params.operationName.empty())
+			if (soonest == _entries.end() || itr->second.expiration < soonest->second.expiration)
+			{
+				soonest = itr;
+			}
+
+			++itr;
+		}
+
+		if (_entries.size() >= _maxEntries && soonest != _entries.end())
 		{
-			message << " name: " << params.operationName;
+			_entries.erase(soonest);
 		}
+	}
 
-		throw schema_exception {
-			{ schema_error { message.str(), { position.line, position.column } } }
-		};
+	if (_maxEntries > 0)
+	{
+		_entries[std::move(key)] = { std::move(response), now + maxAge };
 	}
+}
 
-	auto itr = _operations.find(std::string { strSubscription });
-	SubscriptionDefinitionVisitor subscriptionVisitor(std::move(params),
-		std::move(callback),
-		std::move(fragments),
-		itr->second);
+void ResponseCache::clear()
+{
+	std::lock_guard lock(_mutex);
 
-	peg::for_each_child<peg::operation_definition>(subscriptionVisitor.getRoot(),
-		[&subscriptionVisitor](const peg::ast_node& child) {
-			subscriptionVisitor.visit(child);
-		});
+	_entries.clear();
+}
 
-	auto registration = subscriptionVisitor.getRegistration();
-	auto key = _nextKey++;
+namespace {
 
-	_listeners[registration->field].insert(key);
-	_subscriptions.emplace(key, std::move(registration));
+// Write an unambiguous representation of the variables with the map members in sorted order, so
+// that equivalent variables always produce the same cache key.
+void appendCacheKey(std::ostringstream& key, const response::Value& value)
+{
+	switch (value.type())
+	{
+		case response::Type::Map:
+		{
+			std::vector<std::pair<std::string_view, const response::Value*>> members;
 
-	return key;
-}
+			members.reserve(value.size());
 
-std::future<SubscriptionKey> Request::subscribe(
-	std::launch launch, SubscriptionParams&& params, SubscriptionCallback&& callback)
-{
-	return std::async(
-		launch,
-		[spThis = shared_from_this(), launch](SubscriptionParams&& paramsFuture,
-			SubscriptionCallback&& callbackFuture) {
-			const auto key = spThis->subscribe(std::move(paramsFuture), std::move(callbackFuture));
-			const auto itrOperation = spThis->_operations.find(std::string { strSubscription });
+			for (const auto& entry : value)
+			{
+				members.push_back({ entry.first, &entry.second });
+			}
 
-			if (itrOperation != spThis->_operations.cend())
+			std::sort(members.begin(), members.end(), [](const auto& lhs, const auto& rhs) {
+				return lhs.first < rhs.first;
+			});
+
+			key << '{';
+
+			for (const auto& member : members)
 			{
-				const auto& operation = itrOperation->second;
-				const auto& registration = spThis->_subscriptions.at(key);
-				response::Value emptyFragmentDirectives(response::Type::Map);
-				const SelectionSetParams selectionSetParams {
-					ResolverContext::NotifySubscribe,
-					registration->data->state,
-					registration->data->directives,
-					emptyFragmentDirectives,
-					emptyFragmentDirectives,
-					emptyFragmentDirectives,
-					{},
-					launch,
-				};
+				key << member.first.size() << ':' << member.first;
+				appendCacheKey(key, *member.second);
+			}
 
-				try
-				{
-					operation
-						->resolve(selectionSetParams,
-							registration->selection,
-							registration->data->fragments,
-							registration->data->variables)
-						.get();
-				}
-				catch (const std::exception& ex)
-				{
-					// Rethrow the exception, but don't leave it subscribed if the resolver failed.
-					spThis->unsubscribe(key);
-					throw ex;
-				}
+			key << '}';
+			break;
+		}
+
+		case response::Type::List:
+		{
+			key << '[';
+
+			for (const auto& entry : value.get<response::ListType>())
+			{
+				appendCacheKey(key, entry);
 			}
 
-			return key;
-		},
-		std::move(params),
-		std::move(callback));
-}
+			key << ']';
+			break;
+		}
 
-void Request::unsubscribe(SubscriptionKey key)
-{
-	auto itrSubscription = _subscriptions.find(key);
+		case response::Type::String:
+		case response::Type::EnumValue:
+		{
+			const auto& string = value.get<response::StringType>();
 
-	if (itrSubscription == _subscriptions.cend())
-	{
-		return;
-	}
+			key << (value.type() == response::Type::String ? 's' : 'e') << string.size() << ':'
+				<< string;
+			break;
+		}
 
-	auto itrListener = _listeners.find(itrSubscription->second->field);
+		case response::Type::Boolean:
+			key << (value.get<response::BooleanType>() ? 'T' : 'F');
+			break;
 
-	itrListener->second.erase(key);
-	if (itrListener->second.empty())
-	{
-		_listeners.erase(itrListener);
+		case response::Type::Int:
+			key << 'i' << value.get<response::IntType>() << ';';
+			break;
+
+		case response::Type::Float:
+		{
+			// -0.0 == 0.0, so they should produce the same key.
+			const auto number = value.get<response::FloatType>();
+
+			key << 'd' << std::hexfloat << (number == 0.0 ? 0.0 : number) << std::defaultfloat
+				<< ';';
+			break;
+		}
+
+		case response::Type::Scalar:
+			key << 'S';
+			appendCacheKey(key, value.get<response::ScalarType>());
+			break;
+
+		default:
+			key << 'n';
+			break;
 	}
+}
 
-	_subscriptions.erase(itrSubscription);
+// Subscriptions are indexed on the name and the canonical value of a single argument. The length
+// prefix keeps this from ever being empty, which is the key for subscriptions without arguments.
+std::string makeArgumentIndexKey(std::string_view name, const response::Value& value)
+{
+	std::ostringstream key;
+
+	key << name.size() << ':' << name;
+	appendCacheKey(key, value);
+
+	return key.str();
+}
 
-	if (_subscriptions.empty())
+} // namespace
+
+std::future<std::shared_ptr<const std::string>> Request::resolveCached(std::launch launch,
+	const std::shared_ptr<RequestState>& state, const peg::ast& query,
+	const std::string& operationName, response::Value&& variables,
+	const std::shared_ptr<ResponseCache>& cache) const
+{
+	ResponseCache::Key key;
+	std::ostringstream document;
+	std::ostringstream canonicalVariables;
+
+	// Skip any whitespace and comments between the top level definitions.
+	for (const auto& child : query.root->children)
 	{
-		_nextKey = 0;
+		document << child->string_view() << '\n';
 	}
-	else
+
+	appendCacheKey(canonicalVariables, variables);
+
+	key.document = document.str();
+	key.operationName = operationName;
+	key.variables = canonicalVariables.str();
+
+	if (state)
 	{
-		_nextKey = _subscriptions.crbegin()->first + 1;
+		key.scope = state->getCacheScope();
 	}
-}
 
-std::future<void> Request::unsubscribe(std::launch launch, SubscriptionKey key)
-{
-	return std::async(launch, [spThis = shared_from_this(), launch, key]() {
-		const auto itrOperation = spThis->_operations.find(std::string { strSubscription });
+	if (auto response = cache->find(key))
+	{
+		std::promise<std::shared_ptr<const std::string>> promise;
 
-		if (itrOperation != spThis->_operations.cend())
-		{
-			const auto& operation = itrOperation->second;
-			const auto& registration = spThis->_subscriptions.at(key);
-			response::Value emptyFragmentDirectives(response::Type::Map);
-			const SelectionSetParams selectionSetParams {
-				ResolverContext::NotifyUnsubscribe,
-				registration->data->state,
-				registration->data->directives,
-				emptyFragmentDirectives,
-				emptyFragmentDirectives,
-				emptyFragmentDirectives,
-				{},
-				launch,
-			};
+		promise.set_value(std::move(response));
 
-			operation
-				->resolve(selectionSetParams,
-					registration->selection,
-					registration->data->fragments,
-					registration->data->variables)
-				.get();
-		}
+		return promise.get_future();
+	}
 
-		spThis->unsubscribe(key);
-	});
-}
+	auto cacheControl = std::make_shared<CacheControl>();
+	std::future<response::Value> result;
+	auto errors = validate(query);
 
-void Request::deliver(
-	const SubscriptionName& name, const std::shared_ptr<Object>& subscriptionObject) const
-{
-	deliver(std::launch::deferred, name, subscriptionObject);
-}
+	if (errors.empty())
+	{
+		result = resolveValidated(launch,
+			state,
+			*query.root,
+			operationName,
+			std::move(variables),
+			cacheControl);
+	}
+	else
+	{
+		std::promise<response::Value> promise;
+		response::Value errorDocument(response::Type::Map);
 
-void Request::deliver(const SubscriptionName& name, const SubscriptionArguments& arguments,
-	const std::shared_ptr<Object>& subscriptionObject) const
-{
-	deliver(std::launch::deferred, name, arguments, subscriptionObject);
-}
+		errorDocument.emplace_back(std::string { strData }, response::Value());
+		errorDocument.emplace_back(std::string { strErrors }, buildErrorValues(errors));
+		promise.set_value(std::move(errorDocument));
 
-void Request::deliver(const SubscriptionName& name, const SubscriptionArguments& arguments,
-	const SubscriptionArguments& directives,
-	const std::shared_ptr<Object>& subscriptionObject) const
-{
-	deliver(std::launch::deferred, name, arguments, directives, subscriptionObject);
-}
+		result = promise.get_future();
+	}
 
-void Request::deliver(const SubscriptionName& name,
-	const SubscriptionFilterCallback& applyArguments,
-	const std::shared_ptr<Object>& subscriptionObject) const
-{
-	deliver(std::launch::deferred, name, applyArguments, subscriptionObject);
-}
+	return std::async(
+		launch,
+		[cache, cacheControl, key = std::move(key)](
+			std::future<response::Value> resultFuture) mutable {
+			auto document = resultFuture.get();
+			const bool hasErrors = (document.type() != response::Type::Map
+				|| document.find(std::string { strErrors }) != document.end());
+			auto response = std::make_shared<const std::string>(
+				cache->serialize(std::move(document)));
+			const auto maxAge = cacheControl->getMaxAge();
+
+			if (!hasErrors && maxAge.count() > 0)
+			{
+				cache->insert(std::move(key), response, maxAge);
+			}
 
-void Request::deliver(const SubscriptionName& name,
-	const SubscriptionFilterCallback& applyArguments,
-	const SubscriptionFilterCallback& applyDirectives,
-	const std::shared_ptr<Object>& subscriptionObject) const
-{
-	deliver(std::launch::deferred, name, applyArguments, applyDirectives, subscriptionObject);
+			return response;
+		},
+		std::move(result));
 }
 
-void Request::deliver(std::launch launch, const SubscriptionName& name,
-	const std::shared_ptr<Object>& subscriptionObject) const
+SubscriptionKey Request::subscribe(SubscriptionParams&& params, SubscriptionCallback&& callback)
 {
-	deliver(launch, name, SubscriptionArguments {}, SubscriptionArguments {}, subscriptionObject);
+	return addSubscription(std::move(params), std::move(callback), {})->key;
 }
 
-void Request::deliver(std::launch launch, const SubscriptionName& name,
-	const SubscriptionArguments& arguments, const std::shared_ptr<Object>& subscriptionObject) const
+std::future<SubscriptionKey> Request::subscribe(
+	std::launch launch, SubscriptionParams&& params, SubscriptionCallback&& callback)
 {
-	deliver(launch, name, arguments, SubscriptionArguments {}, subscriptionObject);
+	return addSubscription(launch, std::move(params), std::move(callback), {});
 }
 
-void Request::deliver(std::launch launch, const SubscriptionName& name,
-	const SubscriptionArguments& arguments, const SubscriptionArguments& directives,
-	const std::shared_ptr<Object>& subscriptionObject) const
+SubscriptionKey Request::subscribe(
+	SubscriptionParams&& params, SerializedSubscriptionCallback&& callback)
 {
-	SubscriptionFilterCallback argumentsMatch =
-		[&arguments](response::MapType::const_reference required) noexcept -> bool {
-		auto itrArgument = arguments.find(required.first);
-
-		return (itrArgument != arguments.cend() && itrArgument->second == required.second);
-	};
-
-	SubscriptionFilterCallback directivesMatch =
-		[&directives](response::MapType::const_reference required) noexcept -> bool {
-		auto itrDirective = directives.find(required.first);
-
-		return (itrDirective != directives.cend() && itrDirective->second == required.second);
-	};
+	if (!_subscriptionSerializer)
+	{
+		throw std::logic_error("Missing subscription serializer");
+	}
+	else if (params.deltaSnapshotInterval > 0)
+	{
+		throw std::logic_error("Delta payloads require a SubscriptionCallback");
+	}
 
-	deliver(launch, name, argumentsMatch, directivesMatch, subscriptionObject);
+	return addSubscription(std::move(params), {}, std::move(callback))->key;
 }
 
-void Request::deliver(std::launch launch, const SubscriptionName& name,
-	const SubscriptionFilterCallback& applyArguments,
-	const std::shared_ptr<Object>& subscriptionObject) const
+std::future<SubscriptionKey> Request::subscribe(
+	std::launch launch, SubscriptionParams&& params, SerializedSubscriptionCallback&& callback)
 {
-	deliver(
-		launch,
-		name,
-		applyArguments,
-		[](response::MapType::const_reference) noexcept {
-			return true;
-		},
-		subscriptionObject);
+	if (!_subscriptionSerializer)
+	{
+		throw std::logic_error("Missing subscription serializer");
+	}
+	else if (params.deltaSnapshotInterval > 0)
+	{
+		throw std::logic_error("Delta payloads require a SubscriptionCallback");
+	}
+
+	return addSubscription(launch, std::move(params), {}, std::move(callback));
 }
 
-void Request::deliver(std::launch launch, const SubscriptionName& name,
-	const SubscriptionFilterCallback& applyArguments,
-	const SubscriptionFilterCallback& applyDirectives,
-	const std::shared_ptr<Object>& subscriptionObject) const
+std::shared_ptr<SubscriptionData> Request::addSubscription(SubscriptionParams&& params,
+	SubscriptionCallback&& callback, SerializedSubscriptionCallback&& serializedCallback)
 {
-	const auto& optionalOrDefaultSubscription = subscriptionObject
-		? subscriptionObject
-		: _operations.find(std::string { strSubscription })->second;
+	std::ostringstream documentKey;
 
-	auto itrListeners = _listeners.find(name);
+	// Skip any whitespace and comments between the top level definitions.
+	for (const auto& child : params.query.root->children)
+	{
+		documentKey << child->string_view() << '\n';
+	}
 
-	if (itrListeners == _listeners.cend())
+	auto documentText = documentKey.str();
+	std::shared_ptr<const SubscriptionDocument> document;
+	std::shared_lock documentLock(_subscriptionMutex);
+	auto itrDocument = _documents.find(documentText);
+
+	if (itrDocument != _documents.cend())
 	{
-		return;
+		document = itrDocument->second.lock();
 	}
 
-	std::queue<std::future<void>> callbacks;
+	documentLock.unlock();
 
-	for (const auto& key : itrListeners->second)
+	if (document)
 	{
-		auto itrSubscription = _subscriptions.find(key);
-		auto registration = itrSubscription->second;
-		const auto& subscriptionArguments = registration->arguments;
-		bool matchedArguments = true;
+		// Release the duplicate parse tree and use the shared one, which was already validated.
+		params.query = document->query;
+	}
+	else
+	{
+		auto errors = validate(params.query);
 
-		// If the field in this subscription had arguments that did not match what was provided
-		// in this event, don't deliver the event to this subscription
-		for (const auto& required : subscriptionArguments)
+		if (!errors.empty())
 		{
-			if (!applyArguments(required))
-			{
-				matchedArguments = false;
-				break;
-			}
+			throw schema_exception { std::move(errors) };
 		}
 
-		if (!matchedArguments)
-		{
-			continue;
-		}
+		document = std::make_shared<const SubscriptionDocument>(
+			SubscriptionDocument { params.query });
+	}
 
-		// If the field in this subscription had field directives that did not match what was
-		// provided in this event, don't deliver the event to this subscription
-		const auto& subscriptionFieldDirectives = registration->fieldDirectives;
-		bool matchedFieldDirectives = true;
+	// The fragment directives can depend on the variables, so collect them for each subscription.
+	FragmentDefinitionVisitor fragmentVisitor(params.variables);
 
-		for (const auto& required : subscriptionFieldDirectives)
+	peg::for_each_child<peg::fragment_definition>(*params.query.root,
+		[&fragmentVisitor](const peg::ast_node& child) {
+			fragmentVisitor.visit(child);
+		});
+
+	auto operationDefinition = findOperationDefinition(*params.query.root, params.operationName);
+
+	if (!operationDefinition.second)
+	{
+		std::ostringstream message;
+
+		message << "Missing subscription";
+
+		if (!params.operationName.empty())
 		{
-			if (!applyDirectives(required))
-			{
-				matchedFieldDirectives = false;
-				break;
-			}
+			message << " name: " << params.operationName;
 		}
 
-		if (!matchedFieldDirectives)
+		throw schema_exception { { message.str() } };
+	}
+	else if (operationDefinition.first != strSubscription)
+	{
+		auto position = operationDefinition.second->begin();
+		std::ostringstream message;
+
+		message << "Unexpected operation type: " << operationDefinition.first;
+
+		if (!params.operationName.empty())
 		{
-			continue;
+			message << " name: " << params.operationName;
 		}
 
-		std::future<response::Value> result;
-		response::Value emptyFragmentDirectives(response::Type::Map);
-		const SelectionSetParams selectionSetParams {
-			ResolverContext::Subscription,
-			registration->data->state,
-			registration->data->directives,
-			emptyFragmentDirectives,
-			emptyFragmentDirectives,
-			emptyFragmentDirectives,
-			{},
-			launch,
+		throw schema_exception {
+			{ schema_error { message.str(), { position.line, position.column } } }
 		};
+	}
 
-		try
-		{
-			result = std::async(
-				launch,
-				[registration](std::future<response::Value> document) {
-					return document.get();
-				},
-				optionalOrDefaultSubscription->resolve(selectionSetParams,
-					registration->selection,
-					registration->data->fragments,
-					registration->data->variables));
-		}
-		catch (schema_exception& ex)
-		{
-			std::promise<response::Value> promise;
-			response::Value document(response::Type::Map);
+	const auto minInterval = params.minInterval;
+	const bool coalesce = params.coalesce;
+	const auto deltaSnapshotInterval = params.deltaSnapshotInterval;
+	std::string group;
 
-			document.emplace_back(std::string { strData }, response::Value());
-			document.emplace_back(std::string { strErrors }, ex.getErrors());
-			promise.set_value(std::move(document));
+	if (_groupSubscriptions)
+	{
+		std::ostringstream groupKey;
+
+		// Every subscription with the same document text shares the same SubscriptionDocument, so
+		// only the operation name and variables need to be compared.
+		groupKey << static_cast<const void*>(document.get());
+		groupKey << '\0' << params.operationName.size() << ':' << params.operationName;
+		appendCacheKey(groupKey, params.variables);
+
+		if (params.state)
+		{
+			const auto scope = params.state->getCacheScope();
 
-			result = promise.get_future();
+			groupKey << 'S' << scope.size() << ':' << scope;
 		}
 
-		callbacks.push(std::async(
-			launch,
-			[registration](std::future<response::Value> document) {
-				registration->callback(std::move(document));
-			},
-			std::move(result)));
+		group = groupKey.str();
 	}
 
-	while (!callbacks.empty())
+	auto itr = _operations.find(std::string { strSubscription });
+	SubscriptionDefinitionVisitor subscriptionVisitor(std::move(params),
+		std::move(callback),
+		fragmentVisitor.getFragments(),
+		itr->second);
+
+	peg::for_each_child<peg::operation_definition>(subscriptionVisitor.getRoot(),
+		[&subscriptionVisitor](const peg::ast_node& child) {
+			subscriptionVisitor.visit(child);
+		});
+
+	auto registration = subscriptionVisitor.getRegistration();
+
+	registration->group = std::move(group);
+	registration->serializedCallback = std::move(serializedCallback);
+	registration->minInterval = minInterval;
+	registration->coalesce = coalesce && minInterval.count() > 0;
+	registration->deltaSnapshotInterval = deltaSnapshotInterval;
+
+	auto itrFilterKey = _subscriptionFilterKeys.find(registration->field);
+
+	if (itrFilterKey != _subscriptionFilterKeys.cend())
 	{
-		callbacks.front().get();
-		callbacks.pop();
+		registration->filterKey =
+			std::make_optional(itrFilterKey->second(registration->arguments));
+	}
+	registration->document = document;
+
+	std::unique_lock lock(_subscriptionMutex);
+	auto key = _nextKey++;
+
+	registration->key = key;
+
+	if (_documents.size() >= _maxDocuments)
+	{
+		for (auto itrExpired = _documents.begin(); itrExpired != _documents.end();)
+		{
+			itrExpired = (itrExpired->second.expired() ? _documents.erase(itrExpired)
+													   : std::next(itrExpired));
+		}
+
+		_maxDocuments = std::max(_maxDocuments, _documents.size() * 2);
+	}
+
+	_documents[std::move(documentText)] = document;
+
+	_listeners[registration->field].insert(key);
+	addArgumentIndex(key, *registration);
+
+	if (registration->coalesce)
+	{
+		_coalescedListeners.insert(key);
+	}
+
+	_subscriptions.emplace(key, registration);
+
+	return registration;
+}
+
+std::future<SubscriptionKey> Request::addSubscription(std::launch launch,
+	SubscriptionParams&& params, SubscriptionCallback&& callback,
+	SerializedSubscriptionCallback&& serializedCallback)
+{
+	return std::async(
+		launch,
+		[spThis = shared_from_this(), launch](SubscriptionParams&& paramsFuture,
+			SubscriptionCallback&& callbackFuture,
+			SerializedSubscriptionCallback&& serializedCallbackFuture) {
+			// Keep the registration instead of looking it up again by key, since another thread
+			// may unsubscribe it as soon as it has been added.
+			const auto registration = spThis->addSubscription(std::move(paramsFuture),
+				std::move(callbackFuture),
+				std::move(serializedCallbackFuture));
+			const auto key = registration->key;
+			const auto itrOperation = spThis->_operations.find(std::string { strSubscription });
+
+			if (itrOperation != spThis->_operations.cend())
+			{
+				const auto& operation = itrOperation->second;
+				response::Value emptyFragmentDirectives(response::Type::Map);
+				const SelectionSetParams selectionSetParams {
+					ResolverContext::NotifySubscribe,
+					registration->data->state,
+					registration->data->directives,
+					emptyFragmentDirectives,
+					emptyFragmentDirectives,
+					emptyFragmentDirectives,
+					{},
+					launch,
+					spThis->makeSelectionCounter(),
+				};
+
+				try
+				{
+					operation
+						->resolve(selectionSetParams,
+							registration->selection,
+							registration->data->fragments,
+							registration->data->variables)
+						.get();
+				}
+				catch (const std::exception& ex)
+				{
+					// Rethrow the exception, but don't leave it subscribed if the resolver failed.
+					spThis->unsubscribe(key);
+					throw ex;
+				}
+			}
+
+			return key;
+		},
+		std::move(params),
+		std::move(callback),
+		std::move(serializedCallback));
+}
+
+void Request::unsubscribe(SubscriptionKey key)
+{
+	std::unique_lock lock(_subscriptionMutex);
+	auto itrSubscription = _subscriptions.find(key);
+
+	if (itrSubscription == _subscriptions.cend())
+	{
+		return;
+	}
+
+	auto itrListener = _listeners.find(itrSubscription->second->field);
+
+	itrListener->second.erase(key);
+	if (itrListener->second.empty())
+	{
+		_listeners.erase(itrListener);
+	}
+
+	removeArgumentIndex(key, *itrSubscription->second);
+	_coalescedListeners.erase(key);
+	_subscriptions.erase(itrSubscription);
+}
+
+std::shared_ptr<SubscriptionData> Request::getSubscription(SubscriptionKey key) const
+{
+	std::shared_lock lock(_subscriptionMutex);
+
+	return _subscriptions.at(key);
+}
+
+// Copy the registrations while holding a shared lock, so the callbacks can subscribe or
+// unsubscribe while deliver is still running without invalidating anything.
+template <class KeyContainer>
+std::vector<std::shared_ptr<SubscriptionData>> Request::getSubscriptions(
+	const KeyContainer& keys) const
+{
+	std::vector<std::shared_ptr<SubscriptionData>> registrations;
+
+	registrations.reserve(keys.size());
+
+	for (const auto& key : keys)
+	{
+		registrations.push_back(_subscriptions.at(key));
+	}
+
+	return registrations;
+}
+
+void Request::addArgumentIndex(SubscriptionKey key, const SubscriptionData& registration)
+{
+	if (registration.filterKey)
+	{
+		_filterKeyIndex[registration.field][*registration.filterKey].insert(key);
+	}
+
+	const auto& arguments = registration.arguments;
+	auto& index = _argumentIndex[registration.field];
+
+	if (arguments.size() == 0)
+	{
+		index[{}].insert(key);
+		return;
+	}
+
+	const auto& first = *arguments.begin();
+
+	index[makeArgumentIndexKey(first.first, first.second)].insert(key);
+}
+
+void Request::removeArgumentIndex(SubscriptionKey key, const SubscriptionData& registration)
+{
+	if (registration.filterKey)
+	{
+		auto itrFilterKeys = _filterKeyIndex.find(registration.field);
+
+		if (itrFilterKeys != _filterKeyIndex.end())
+		{
+			auto& index = itrFilterKeys->second;
+			auto itrKeys = index.find(*registration.filterKey);
+
+			if (itrKeys != index.end())
+			{
+				itrKeys->second.erase(key);
+				if (itrKeys->second.empty())
+				{
+					index.erase(itrKeys);
+				}
+			}
+
+			if (index.empty())
+			{
+				_filterKeyIndex.erase(itrFilterKeys);
+			}
+		}
+	}
+
+	const auto& arguments = registration.arguments;
+	auto itrIndex = _argumentIndex.find(registration.field);
+
+	if (itrIndex == _argumentIndex.end())
+	{
+		return;
+	}
+
+	auto& index = itrIndex->second;
+	auto itrKeys = index.find(arguments.size() == 0
+			? std::string {}
+			: makeArgumentIndexKey(arguments.begin()->first, arguments.begin()->second));
+
+	if (itrKeys != index.end())
+	{
+		itrKeys->second.erase(key);
+		if (itrKeys->second.empty())
+		{
+			index.erase(itrKeys);
+		}
+	}
+
+	if (index.empty())
+	{
+		_argumentIndex.erase(itrIndex);
+	}
+}
+
+std::future<void> Request::unsubscribe(std::launch launch, SubscriptionKey key)
+{
+	return std::async(launch, [spThis = shared_from_this(), launch, key]() {
+		const auto itrOperation = spThis->_operations.find(std::string { strSubscription });
+
+		if (itrOperation != spThis->_operations.cend())
+		{
+			const auto& operation = itrOperation->second;
+			const auto registration = spThis->getSubscription(key);
+			response::Value emptyFragmentDirectives(response::Type::Map);
+			const SelectionSetParams selectionSetParams {
+				ResolverContext::NotifyUnsubscribe,
+				registration->data->state,
+				registration->data->directives,
+				emptyFragmentDirectives,
+				emptyFragmentDirectives,
+				emptyFragmentDirectives,
+				{},
+				launch,
+				spThis->makeSelectionCounter(),
+			};
+
+			operation
+				->resolve(selectionSetParams,
+					registration->selection,
+					registration->data->fragments,
+					registration->data->variables)
+				.get();
+		}
+
+		spThis->unsubscribe(key);
+	});
+}
+
+void Request::deliver(
+	const SubscriptionName& name, const std::shared_ptr<Object>& subscriptionObject) const
+{
+	deliver(std::launch::deferred, name, subscriptionObject);
+}
+
+void Request::deliver(const SubscriptionName& name, const SubscriptionArguments& arguments,
+	const std::shared_ptr<Object>& subscriptionObject) const
+{
+	deliver(std::launch::deferred, name, arguments, subscriptionObject);
+}
+
+void Request::deliver(const SubscriptionName& name, const SubscriptionArguments& arguments,
+	const SubscriptionArguments& directives,
+	const std::shared_ptr<Object>& subscriptionObject) const
+{
+	deliver(std::launch::deferred, name, arguments, directives, subscriptionObject);
+}
+
+void Request::deliver(const SubscriptionName& name,
+	const SubscriptionFilterCallback& applyArguments,
+	const std::shared_ptr<Object>& subscriptionObject) const
+{
+	deliver(std::launch::deferred, name, applyArguments, subscriptionObject);
+}
+
+void Request::deliver(const SubscriptionName& name,
+	const SubscriptionFilterCallback& applyArguments,
+	const SubscriptionFilterCallback& applyDirectives,
+	const std::shared_ptr<Object>& subscriptionObject) const
+{
+	deliver(std::launch::deferred, name, applyArguments, applyDirectives, subscriptionObject);
+}
+
+void Request::deliver(const SubscriptionName& name, const std::string& filterKey,
+	const std::shared_ptr<Object>& subscriptionObject) const
+{
+	deliver(std::launch::deferred, name, filterKey, subscriptionObject);
+}
+
+void Request::deliver(std::launch launch, const SubscriptionName& name,
+	const std::shared_ptr<Object>& subscriptionObject) const
+{
+	deliver(launch, name, SubscriptionArguments {}, SubscriptionArguments {}, subscriptionObject);
+}
+
+void Request::deliver(std::launch launch, const SubscriptionName& name,
+	const SubscriptionArguments& arguments, const std::shared_ptr<Object>& subscriptionObject) const
+{
+	deliver(launch, name, arguments, SubscriptionArguments {}, subscriptionObject);
+}
+
+void Request::deliver(std::launch launch, const SubscriptionName& name,
+	const SubscriptionArguments& arguments, const SubscriptionArguments& directives,
+	const std::shared_ptr<Object>& subscriptionObject) const
+{
+	SubscriptionFilterCallback argumentsMatch =
+		[&arguments](response::MapType::const_reference required) noexcept -> bool {
+		auto itrArgument = arguments.find(required.first);
+
+		return (itrArgument != arguments.cend() && itrArgument->second == required.second);
+	};
+
+	SubscriptionFilterCallback directivesMatch =
+		[&directives](response::MapType::const_reference required) noexcept -> bool {
+		auto itrDirective = directives.find(required.first);
+
+		return (itrDirective != directives.cend() && itrDirective->second == required.second);
+	};
+
+	std::vector<SubscriptionKey> keys;
+	std::shared_lock lock(_subscriptionMutex);
+	auto itrIndex = _argumentIndex.find(name);
+
+	if (itrIndex == _argumentIndex.cend())
+	{
+		return;
+	}
+
+	// A subscription can only match if the value of its first argument is one of the arguments
+	// in this event, so collect the candidates from the index instead of checking every listener.
+	const auto& index = itrIndex->second;
+	const auto addCandidates = [&index, &keys](const std::string& indexKey) {
+		auto itrKeys = index.find(indexKey);
+
+		if (itrKeys != index.cend())
+		{
+			keys.insert(keys.end(), itrKeys->second.cbegin(), itrKeys->second.cend());
+		}
+	};
+
+	addCandidates({});
+
+	for (const auto& argument : arguments)
+	{
+		addCandidates(makeArgumentIndexKey(argument.first, argument.second));
+	}
+
+	// Each subscription is only indexed once, but deliver them in the same order as the
+	// unindexed overloads.
+	std::sort(keys.begin(), keys.end());
+
+	auto registrations = getSubscriptions(keys);
+
+	lock.unlock();
+	deliverToRegistrations(
+		launch, registrations, argumentsMatch, directivesMatch, subscriptionObject);
+}
+
+void Request::deliver(std::launch launch, const SubscriptionName& name,
+	const SubscriptionFilterCallback& applyArguments,
+	const std::shared_ptr<Object>& subscriptionObject) const
+{
+	deliver(
+		launch,
+		name,
+		applyArguments,
+		[](response::MapType::const_reference) noexcept {
+			return true;
+		},
+		subscriptionObject);
+}
+
+void Request::deliver(std::launch launch, const SubscriptionName& name,
+	const SubscriptionFilterCallback& applyArguments,
+	const SubscriptionFilterCallback& applyDirectives,
+	const std::shared_ptr<Object>& subscriptionObject) const
+{
+	std::shared_lock lock(_subscriptionMutex);
+	auto itrListeners = _listeners.find(name);
+
+	if (itrListeners == _listeners.cend())
+	{
+		return;
+	}
+
+	auto registrations = getSubscriptions(itrListeners->second);
+
+	lock.unlock();
+	deliverToRegistrations(
+		launch, registrations, applyArguments, applyDirectives, subscriptionObject);
+}
+
+void Request::deliver(std::launch launch, const SubscriptionName& name,
+	const std::string& filterKey, const std::shared_ptr<Object>& subscriptionObject) const
+{
+	std::shared_lock lock(_subscriptionMutex);
+	auto itrIndex = _filterKeyIndex.find(name);
+
+	if (itrIndex == _filterKeyIndex.cend())
+	{
+		return;
+	}
+
+	auto itrKeys = itrIndex->second.find(filterKey);
+
+	if (itrKeys == itrIndex->second.cend())
+	{
+		return;
+	}
+
+	auto registrations = getSubscriptions(itrKeys->second);
+
+	lock.unlock();
+
+	// The filter key already matched the arguments when the subscriptions were added.
+	const SubscriptionFilterCallback matchAll = [](response::MapType::const_reference) noexcept {
+		return true;
+	};
+
+	deliverToRegistrations(launch, registrations, matchAll, matchAll, subscriptionObject);
+}
+
+namespace {
+
+// Replace the result with a patch against the previous result, unless it's time for another full
+// snapshot. Hold the lock while invoking the callback, so it receives the patches in the same
+// order they were built.
+void invokeDeltaCallback(SubscriptionData& registration, std::future<response::Value> document)
+{
+	std::lock_guard lock(registration.deltaMutex);
+	std::promise<response::Value> promise;
+	response::Value result;
+
+	try
+	{
+		result = document.get();
+	}
+	catch (...)
+	{
+		// Pass the exception through to the callback, and start over with a full snapshot.
+		registration.previousResult.reset();
+		promise.set_exception(std::current_exception());
+		registration.callback(promise.get_future());
+		return;
+	}
+
+	const bool hasErrors = (result.type() != response::Type::Map
+		|| result.find(std::string { strErrors }) != result.end());
+
+	if (hasErrors || !registration.previousResult
+		|| registration.deltaCount >= registration.deltaSnapshotInterval)
+	{
+		if (hasErrors)
+		{
+			registration.previousResult.reset();
+		}
+		else
+		{
+			registration.previousResult = std::make_optional<response::Value>(result);
+		}
+
+		registration.deltaCount = 1;
+		promise.set_value(std::move(result));
+	}
+	else
+	{
+		response::Value delta(response::Type::Map);
+
+		delta.emplace_back(std::string { strPatch },
+			response::makePatch(*registration.previousResult, result));
+		registration.previousResult = std::move(result);
+		++registration.deltaCount;
+		promise.set_value(std::move(delta));
+	}
+
+	registration.callback(promise.get_future());
+}
+
+} // namespace
+
+std::optional<std::chrono::steady_clock::time_point> Request::deliverPending() const
+{
+	return deliverPending(std::launch::deferred);
+}
+
+std::optional<std::chrono::steady_clock::time_point> Request::deliverPending(
+	std::launch launch) const
+{
+	const auto now = getSubscriptionTime();
+	std::optional<std::chrono::steady_clock::time_point> nextPending;
+	std::vector<std::pair<std::shared_ptr<Object>, std::vector<std::shared_ptr<SubscriptionData>>>>
+		events;
+	std::shared_lock lock(_subscriptionMutex);
+	const auto registrations = getSubscriptions(_coalescedListeners);
+
+	lock.unlock();
+
+	for (const auto& registration : registrations)
+	{
+		std::lock_guard throttleLock(registration->throttleMutex);
+
+		if (!registration->pendingEvent)
+		{
+			continue;
+		}
+
+		const auto ready = registration->lastDelivery + registration->minInterval;
+
+		if (ready > now)
+		{
+			nextPending = nextPending ? std::min(*nextPending, ready) : ready;
+			continue;
+		}
+
+		// Subscriptions which are waiting for the same event can still share the result.
+		auto itrEvent = std::find_if(events.begin(),
+			events.end(),
+			[&pendingEvent = *registration->pendingEvent](const auto& event) noexcept {
+				return event.first == pendingEvent;
+			});
+
+		if (itrEvent == events.end())
+		{
+			itrEvent = events.insert(events.end(), { *registration->pendingEvent, {} });
+		}
+
+		itrEvent->second.push_back(registration);
+		registration->lastDelivery = now;
+		registration->pendingEvent.reset();
+	}
+
+	// These events already matched the arguments and directives when they were held back.
+	const SubscriptionFilterCallback matchAll = [](response::MapType::const_reference) noexcept {
+		return true;
+	};
+
+	for (const auto& event : events)
+	{
+		deliverToRegistrations(launch, event.second, matchAll, matchAll, event.first, false);
+	}
+
+	return nextPending;
+}
+
+void Request::deliverToRegistrations(std::launch launch,
+	const std::vector<std::shared_ptr<SubscriptionData>>& registrations,
+	const SubscriptionFilterCallback& applyArguments,
+	const SubscriptionFilterCallback& applyDirectives,
+	const std::shared_ptr<Object>& subscriptionObject, bool applyThrottle /*= true*/) const
+{
+	const auto shardCount = std::min(_deliveryShards, registrations.size());
+
+	if (shardCount <= 1)
+	{
+		deliverToShard(launch,
+			registrations,
+			applyArguments,
+			applyDirectives,
+			subscriptionObject,
+			applyThrottle);
+		return;
+	}
+
+	// Keep every subscription in a group on the same shard so they can still share the result,
+	// and preserve the relative order of the subscriptions within each shard.
+	std::vector<std::vector<std::shared_ptr<SubscriptionData>>> shards(shardCount);
+
+	for (const auto& registration : registrations)
+	{
+		const auto shard = (registration->group.empty()
+				? registration->key
+				: std::hash<std::string> {}(registration->group))
+			% shardCount;
+
+		shards[shard].push_back(registration);
+	}
+
+	std::vector<std::future<void>> workers;
+
+	workers.reserve(shardCount - 1);
+
+	// Use the same launch policy as the rest of the delivery, so std::launch::deferred delivers
+	// each shard in turn on this thread, and only std::launch::async starts more threads.
+	for (size_t shard = 1; shard < shardCount; ++shard)
+	{
+		if (shards[shard].empty())
+		{
+			continue;
+		}
+
+		workers.push_back(std::async(launch,
+			[this, launch, &shards, shard, &applyArguments, &applyDirectives, &subscriptionObject,
+				applyThrottle]() {
+				deliverToShard(launch,
+					shards[shard],
+					applyArguments,
+					applyDirectives,
+					subscriptionObject,
+					applyThrottle);
+			}));
+	}
+
+	// Deliver the first shard on this thread while any others are running.
+	deliverToShard(launch,
+		shards.front(),
+		applyArguments,
+		applyDirectives,
+		subscriptionObject,
+		applyThrottle);
+
+	for (auto& worker : workers)
+	{
+		worker.get();
+	}
+}
+
+void Request::deliverToShard(std::launch launch,
+	const std::vector<std::shared_ptr<SubscriptionData>>& registrations,
+	const SubscriptionFilterCallback& applyArguments,
+	const SubscriptionFilterCallback& applyDirectives,
+	const std::shared_ptr<Object>& subscriptionObject, bool applyThrottle) const
+{
+	const auto& optionalOrDefaultSubscription = subscriptionObject
+		? subscriptionObject
+		: _operations.find(std::string { strSubscription })->second;
+	const auto now = getSubscriptionTime();
+
+	std::queue<std::future<void>> callbacks;
+	std::unordered_map<std::string_view, std::shared_future<response::Value>> groups;
+	std::unordered_map<std::string_view, std::shared_future<std::shared_ptr<const std::string>>>
+		serializedGroups;
+
+	for (const auto& registration : registrations)
+	{
+		const auto& subscriptionArguments = registration->arguments;
+		bool matchedArguments = true;
+
+		// If the field in this subscription had arguments that did not match what was provided
+		// in this event, don't deliver the event to this subscription
+		for (const auto& required : subscriptionArguments)
+		{
+			if (!applyArguments(required))
+			{
+				matchedArguments = false;
+				break;
+			}
+		}
+
+		if (!matchedArguments)
+		{
+			continue;
+		}
+
+		// If the field in this subscription had field directives that did not match what was
+		// provided in this event, don't deliver the event to this subscription
+		const auto& subscriptionFieldDirectives = registration->fieldDirectives;
+		bool matchedFieldDirectives = true;
+
+		for (const auto& required : subscriptionFieldDirectives)
+		{
+			if (!applyDirectives(required))
+			{
+				matchedFieldDirectives = false;
+				break;
+			}
+		}
+
+		if (!matchedFieldDirectives)
+		{
+			continue;
+		}
+
+		if (applyThrottle && registration->minInterval.count() > 0)
+		{
+			std::lock_guard throttleLock(registration->throttleMutex);
+
+			// If it's too soon, either hold onto the latest event for deliverPending or drop it,
+			// but don't resolve anything yet.
+			if (now - registration->lastDelivery < registration->minInterval)
+			{
+				if (registration->coalesce)
+				{
+					registration->pendingEvent = subscriptionObject;
+				}
+
+				continue;
+			}
+
+			registration->lastDelivery = now;
+			registration->pendingEvent.reset();
+		}
+
+		std::future<response::Value> result;
+		std::shared_future<response::Value> shared;
+
+		// Every subscription in a group has the same arguments and field directives, so if one of
+		// them matched and has already been resolved, the rest can share its result.
+		const bool grouped = !registration->group.empty();
+		const auto itrGroup = grouped ? groups.find(registration->group) : groups.end();
+
+		if (itrGroup != groups.end())
+		{
+			shared = itrGroup->second;
+		}
+		else
+		{
+			response::Value emptyFragmentDirectives(response::Type::Map);
+			const SelectionSetParams selectionSetParams {
+				ResolverContext::Subscription,
+				registration->data->state,
+				registration->data->directives,
+				emptyFragmentDirectives,
+				emptyFragmentDirectives,
+				emptyFragmentDirectives,
+				{},
+				launch,
+				makeSelectionCounter(),
+			};
+
+			try
+			{
+				result = std::async(
+					launch,
+					[registration](std::future<response::Value> document) {
+						return document.get();
+					},
+					optionalOrDefaultSubscription->resolve(selectionSetParams,
+						registration->selection,
+						registration->data->fragments,
+						registration->data->variables));
+			}
+			catch (schema_exception& ex)
+			{
+				std::promise<response::Value> promise;
+				response::Value document(response::Type::Map);
+
+				document.emplace_back(std::string { strData }, response::Value());
+				document.emplace_back(std::string { strErrors }, ex.getErrors());
+				promise.set_value(std::move(document));
+
+				result = promise.get_future();
+			}
+
+			if (grouped)
+			{
+				shared = result.share();
+				groups.emplace(registration->group, shared);
+			}
+		}
+
+		if (registration->serializedCallback)
+		{
+			// Serialize each distinct result once, and share the same buffer with every
+			// subscription in the group.
+			std::shared_future<std::shared_ptr<const std::string>> serialized;
+			const auto itrSerialized =
+				grouped ? serializedGroups.find(registration->group) : serializedGroups.end();
+
+			if (itrSerialized != serializedGroups.end())
+			{
+				serialized = itrSerialized->second;
+			}
+			else
+			{
+				std::future<std::shared_ptr<const std::string>> payload;
+
+				if (shared.valid())
+				{
+					payload = std::async(launch, [serialize = _subscriptionSerializer, shared]() {
+						return std::make_shared<const std::string>(
+							serialize(response::Value(shared.get())));
+					});
+				}
+				else
+				{
+					payload = std::async(
+						launch,
+						[serialize = _subscriptionSerializer](
+							std::future<response::Value> document) {
+							return std::make_shared<const std::string>(serialize(document.get()));
+						},
+						std::move(result));
+				}
+
+				serialized = payload.share();
+
+				if (grouped)
+				{
+					serializedGroups.emplace(registration->group, serialized);
+				}
+			}
+
+			callbacks.push(std::async(
+				launch,
+				[registration](std::shared_future<std::shared_ptr<const std::string>> payload) {
+					registration->serializedCallback(
+						std::async(std::launch::deferred, [payload]() {
+							return payload.get();
+						}));
+				},
+				std::move(serialized)));
+			continue;
+		}
+
+		if (shared.valid())
+		{
+			result = std::async(launch, [shared]() {
+				return response::Value(shared.get());
+			});
+		}
+
+		if (registration->deltaSnapshotInterval > 0)
+		{
+			callbacks.push(std::async(
+				launch,
+				[registration](std::future<response::Value> document) {
+					invokeDeltaCallback(*registration, std::move(document));
+				},
+				std::move(result)));
+			continue;
+		}
+
+		callbacks.push(std::async(
+			launch,
+			[registration](std::future<response::Value> document) {
+				registration->callback(std::move(document));
+			},
+			std::move(result)));
+	}
+
+	while (!callbacks.empty())
+	{
+		callbacks.front().get();
+		callbacks.pop();
+	}
+}
+
+struct SubscriptionDispatcher::State
+{
+	// The results waiting to be passed to the callback for a single subscription.
+	struct Subscriber
+	{
+		SubscriptionCallback callback;
+		std::optional<SubscriptionKey> key;
+		std::deque<response::Value> pending;
+		bool draining = false;
+		bool disconnected = false;
+	};
+
+	State(size_t maxPending, SubscriptionOverflow overflow, size_t maxEvents)
+		: maxPending(std::max<size_t>(1, maxPending))
+		, overflow(overflow)
+		, maxEvents(std::max<size_t>(1, maxEvents))
+	{
+	}
+
+	void work();
+	void enqueue(std::function<void()>&& task);
+	void deliverEvents(const std::shared_ptr<State>& state);
+	void push(const std::shared_ptr<State>& state, const std::shared_ptr<Subscriber>& subscriber,
+		response::Value&& document);
+	void drain(const std::shared_ptr<State>& state, const std::shared_ptr<Subscriber>& subscriber);
+
+	const size_t maxPending;
+	const SubscriptionOverflow overflow;
+	const size_t maxEvents;
+
+	// The State which owns the worker running on this thread, if any.
+	static inline thread_local const State* currentWorker = nullptr;
+
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::condition_variable idle;
+	std::condition_variable space;
+	std::deque<std::function<void()>> tasks;
+	std::deque<std::function<void()>> events;
+	bool delivering = false;
+	size_t running = 0;
+	bool stopping = false;
+	std::shared_ptr<Request> service;
+	std::unordered_map<SubscriptionKey, std::shared_ptr<Subscriber>> subscribers;
+};
+
+void SubscriptionDispatcher::State::work()
+{
+	currentWorker = this;
+
+	std::unique_lock lock(mutex);
+
+	for (;;)
+	{
+		ready.wait(lock, [this]() noexcept {
+			return stopping || !tasks.empty();
+		});
+
+		// Finish all of the pending tasks before stopping.
+		if (tasks.empty())
+		{
+			break;
+		}
+
+		auto task = std::move(tasks.front());
+
+		tasks.pop_front();
+		++running;
+		lock.unlock();
+
+		// There's nobody waiting on the worker threads to report an exception to, and a
+		// std::thread would call std::terminate if we let it escape.
+		try
+		{
+			task();
+		}
+		catch (...)
+		{
+		}
+
+		lock.lock();
+		--running;
+
+		if (tasks.empty() && running == 0)
+		{
+			idle.notify_all();
+		}
+	}
+}
+
+void SubscriptionDispatcher::State::enqueue(std::function<void()>&& task)
+{
+	tasks.push_back(std::move(task));
+	ready.notify_one();
+}
+
+// Deliver one event at a time, in the order they were queued, so every subscription pushes its
+// results in the same order even if there are multiple workers. The callbacks can still run in
+// parallel on the other workers.
+void SubscriptionDispatcher::State::deliverEvents(const std::shared_ptr<State>& state)
+{
+	std::unique_lock lock(mutex);
+	auto event = std::move(events.front());
+
+	events.pop_front();
+	space.notify_one();
+	lock.unlock();
+
+	try
+	{
+		event();
+	}
+	catch (...)
+	{
+	}
+
+	lock.lock();
+
+	if (events.empty())
+	{
+		delivering = false;
+		return;
+	}
+
+	// Go to the back of the line after each event, so the callbacks for the results it just pushed
+	// get a turn before the next event.
+	enqueue([state]() {
+		state->deliverEvents(state);
+	});
+}
+
+void SubscriptionDispatcher::State::push(const std::shared_ptr<State>& state,
+	const std::shared_ptr<Subscriber>& subscriber, response::Value&& document)
+{
+	std::unique_lock lock(mutex);
+
+	if (subscriber->disconnected)
+	{
+		return;
+	}
+
+	if (subscriber->pending.size() >= maxPending)
+	{
+		switch (overflow)
+		{
+			case SubscriptionOverflow::DropOldest:
+				subscriber->pending.pop_front();
+				break;
+
+			case SubscriptionOverflow::Coalesce:
+				subscriber->pending.clear();
+				break;
+
+			case SubscriptionOverflow::Disconnect:
+			{
+				subscriber->disconnected = true;
+				subscriber->pending.clear();
+
+				document = response::Value(response::Type::Map);
+				document.emplace_back(std::string { strData }, response::Value());
+				document.emplace_back(std::string { strErrors },
+					buildErrorValues({ { "Subscription queue overflow" } }));
+
+				// If subscribe has not returned the key yet, it will unsubscribe instead.
+				if (subscriber->key)
+				{
+					enqueue([state, subscriber]() {
+						const auto key = *subscriber->key;
+						std::unique_lock lock(state->mutex);
+						auto itr = state->subscribers.find(key);
+
+						// Nobody else can reuse the key until after we unsubscribe.
+						if (itr != state->subscribers.end() && itr->second == subscriber)
+						{
+							state->subscribers.erase(itr);
+						}
+
+						lock.unlock();
+						state->service->unsubscribe(key);
+					});
+				}
+				break;
+			}
+		}
+	}
+
+	subscriber->pending.push_back(std::move(document));
+
+	if (!subscriber->draining)
+	{
+		subscriber->draining = true;
+		enqueue([state, subscriber]() {
+			state->drain(state, subscriber);
+		});
+	}
+}
+
+void SubscriptionDispatcher::State::drain(
+	const std::shared_ptr<State>& state, const std::shared_ptr<Subscriber>& subscriber)
+{
+	std::unique_lock lock(mutex);
+
+	if (subscriber->pending.empty())
+	{
+		subscriber->draining = false;
+		return;
+	}
+
+	std::promise<response::Value> promise;
+
+	promise.set_value(std::move(subscriber->pending.front()));
+	subscriber->pending.pop_front();
+	lock.unlock();
+
+	// Only invoke the callback for one result at a time, and then go to the back of the line, so
+	// a subscription with a long queue doesn't starve the others. An exception from one callback
+	// shouldn't stop delivering the rest of its results either.
+	try
+	{
+		subscriber->callback(promise.get_future());
+	}
+	catch (...)
+	{
+	}
+
+	lock.lock();
+	enqueue([state, subscriber]() {
+		state->drain(state, subscriber);
+	});
+}
+
+SubscriptionDispatcher::SubscriptionDispatcher(std::shared_ptr<Request> service,
+	size_t workerCount /*= 1*/, size_t maxPending /*= 16*/,
+	SubscriptionOverflow overflow /*= SubscriptionOverflow::DropOldest*/,
+	size_t maxEvents /*= 256*/)
+	: _service(std::move(service))
+	, _state(std::make_shared<State>(maxPending, overflow, maxEvents))
+{
+	_state->service = _service;
+	workerCount = std::max<size_t>(1, workerCount);
+	_workers.reserve(workerCount);
+
+	for (size_t i = 0; i < workerCount; ++i)
+	{
+		_workers.emplace_back([state = _state]() {
+			state->work();
+		});
+	}
+}
+
+SubscriptionDispatcher::~SubscriptionDispatcher()
+{
+	std::unique_lock lock(_state->mutex);
+
+	_state->stopping = true;
+	_state->ready.notify_all();
+	lock.unlock();
+
+	for (auto& worker : _workers)
+	{
+		worker.join();
+	}
+
+	// The workers have all stopped, so nothing else is using the subscribers.
+	for (const auto& entry : _state->subscribers)
+	{
+		if (!entry.second->disconnected)
+		{
+			_service->unsubscribe(entry.first);
+		}
+	}
+
+	_state->service.reset();
+}
+
+SubscriptionKey SubscriptionDispatcher::subscribe(
+	SubscriptionParams&& params, SubscriptionCallback&& callback)
+{
+	// Dropping or coalescing a result would leave the client applying the next patch to the wrong
+	// document, so the dispatcher only queues full results.
+	if (params.deltaSnapshotInterval > 0)
+	{
+		throw std::logic_error("SubscriptionDispatcher does not support delta payloads");
+	}
+
+	auto subscriber = std::make_shared<State::Subscriber>();
+	std::weak_ptr<State> weakState { _state };
+
+	subscriber->callback = std::move(callback);
+
+	// The Request resolves the subscription on one of the worker threads while delivering the
+	// event, and this adds the result to the queue for the subscription's own callback.
+	const auto key = _service->subscribe(std::move(params),
+		[weakState, subscriber](std::future<response::Value> result) {
+			auto state = weakState.lock();
+
+			if (!state)
+			{
+				return;
+			}
+
+			response::Value document;
+
+			try
+			{
+				document = result.get();
+			}
+			catch (const std::exception& ex)
+			{
+				document = response::Value(response::Type::Map);
+				document.emplace_back(std::string { strData }, response::Value());
+				document.emplace_back(std::string { strErrors },
+					buildErrorValues({ { ex.what() } }));
+			}
+
+			state->push(state, subscriber, std::move(document));
+		});
+
+	std::unique_lock lock(_state->mutex);
+
+	subscriber->key = key;
+
+	if (subscriber->disconnected)
+	{
+		lock.unlock();
+		_service->unsubscribe(key);
+	}
+	else
+	{
+		_state->subscribers.emplace(key, std::move(subscriber));
+	}
+
+	return key;
+}
+
+void SubscriptionDispatcher::unsubscribe(SubscriptionKey key)
+{
+	std::unique_lock lock(_state->mutex);
+	auto itr = _state->subscribers.find(key);
+
+	if (itr == _state->subscribers.end())
+	{
+		return;
+	}
+
+	// If it already overflowed, there's a task in the queue which will unsubscribe it.
+	const bool disconnected = itr->second->disconnected;
+
+	itr->second->disconnected = true;
+	itr->second->pending.clear();
+	_state->subscribers.erase(itr);
+	lock.unlock();
+
+	if (!disconnected)
+	{
+		_service->unsubscribe(key);
+	}
+}
+
+void SubscriptionDispatcher::deliver(
+	const SubscriptionName& name, const std::shared_ptr<Object>& subscriptionObject)
+{
+	deliver(name, SubscriptionArguments {}, SubscriptionArguments {}, subscriptionObject);
+}
+
+void SubscriptionDispatcher::deliver(const SubscriptionName& name,
+	SubscriptionArguments&& arguments, const std::shared_ptr<Object>& subscriptionObject)
+{
+	deliver(name, std::move(arguments), SubscriptionArguments {}, subscriptionObject);
+}
+
+void SubscriptionDispatcher::deliver(const SubscriptionName& name,
+	SubscriptionArguments&& arguments, SubscriptionArguments&& directives,
+	const std::shared_ptr<Object>& subscriptionObject)
+{
+	// std::function needs a copyable target, so share the arguments instead of moving them.
+	enqueue([service = _service,
+				name,
+				arguments = std::make_shared<const SubscriptionArguments>(std::move(arguments)),
+				directives = std::make_shared<const SubscriptionArguments>(std::move(directives)),
+				subscriptionObject]() {
+		service->deliver(std::launch::deferred, name, *arguments, *directives, subscriptionObject);
+	});
+}
+
+void SubscriptionDispatcher::deliver(const SubscriptionName& name,
+	SubscriptionFilterCallback&& applyArguments, const std::shared_ptr<Object>& subscriptionObject)
+{
+	enqueue([service = _service,
+				name,
+				applyArguments = std::move(applyArguments),
+				subscriptionObject]() {
+		service->deliver(std::launch::deferred, name, applyArguments, subscriptionObject);
+	});
+}
+
+void SubscriptionDispatcher::deliver(const SubscriptionName& name, std::string&& filterKey,
+	const std::shared_ptr<Object>& subscriptionObject)
+{
+	enqueue([service = _service, name, filterKey = std::move(filterKey), subscriptionObject]() {
+		service->deliver(std::launch::deferred, name, filterKey, subscriptionObject);
+	});
+}
+
+void SubscriptionDispatcher::flush()
+{
+	std::unique_lock lock(_state->mutex);
+
+	_state->idle.wait(lock, [this]() noexcept {
+		return _state->tasks.empty() && _state->running == 0;
+	});
+}
+
+void SubscriptionDispatcher::enqueue(std::function<void()>&& event)
+{
+	std::unique_lock lock(_state->mutex);
+
+	// Wait for the workers to catch up if the queue is full. A callback which delivers another
+	// event is already running on one of the workers, so blocking it could deadlock.
+	if (State::currentWorker != _state.get())
+	{
+		_state->space.wait(lock, [this]() noexcept {
+			return _state->events.size() < _state->maxEvents;
+		});
+	}
+
+	_state->events.push_back(std::move(event));
+
+	if (!_state->delivering)
+	{
+		_state->delivering = true;
+		_state->enqueue([state = _state]() {
+			state->deliverEvents(state);
+		});
 	}
 }
 
@@ -6,105 +6,191 @@
 #define RAPIDJSON_NAMESPACE graphql::rapidjson
 #include <rapidjson/rapidjson.h>
 
+#include <rapidjson/memorystream.h>
+#include <rapidjson/ostreamwrapper.h>
 #include <rapidjson/reader.h>
-#include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
+#include <algorithm>
+#include <cctype>
+#include <charconv>
 #include <limits>
-#include <stack>
+#include <locale>
+#include <sstream>
 #include <stdexcept>
+#include <vector>
 
 namespace graphql::response {
 
-void writeResponse(rapidjson::Writer<rapidjson::StringBuffer>& writer, Value&& response)
+// RapidJSON output stream which appends directly to a caller-provided std::string.
+class StringOutputStream
 {
-	switch (response.type())
-	{
-		case Type::Map:
-		{
-			auto members = response.release<MapType>();
+public:
+	using Ch = char;
 
-			writer.StartObject();
+	explicit StringOutputStream(std::string& output)
+		: _output(output)
+	{
+	}
 
-			for (auto& entry : members)
-			{
-				writer.Key(entry.first.c_str());
-				writeResponse(writer, std::move(entry.second));
-			}
+	void Put(Ch c)
+	{
+		_output.push_back(c);
+	}
 
-			writer.EndObject();
-			break;
-		}
+	void Flush()
+	{
+	}
 
-		case Type::List:
-		{
-			auto elements = response.release<ListType>();
+private:
+	std::string& _output;
+};
 
-			writer.StartArray();
+// RapidJSON output stream which fills a buffer of chunkSize bytes and passes it to the callback
+// each time it fills up.
+class ChunkOutputStream
+{
+public:
+	using Ch = char;
 
-			for (auto& entry : elements)
-			{
-				writeResponse(writer, std::move(entry));
-			}
+	explicit ChunkOutputStream(const JSONChunkCallback& callback, size_t chunkSize)
+		: _callback(callback)
+		, _chunkSize(chunkSize == 0 ? 1 : chunkSize)
+	{
+		_chunk.reserve(_chunkSize);
+	}
 
-			writer.EndArray();
-			break;
-		}
+	void Put(Ch c)
+	{
+		_chunk.push_back(c);
 
-		case Type::String:
-		case Type::EnumValue:
+		if (_chunk.size() == _chunkSize)
 		{
-			auto value = response.release<StringType>();
-
-			writer.String(value.c_str());
-			break;
+			Flush();
 		}
+	}
 
-		case Type::Null:
+	void Flush()
+	{
+		if (!_chunk.empty())
 		{
-			writer.Null();
-			break;
+			_callback(std::string_view { _chunk });
+			_chunk.clear();
 		}
+	}
 
-		case Type::Boolean:
-		{
-			writer.Bool(response.get<BooleanType>());
-			break;
-		}
+private:
+	const JSONChunkCallback& _callback;
+	const size_t _chunkSize;
+	std::string _chunk;
+};
 
-		case Type::Int:
-		{
-			writer.Int(response.get<IntType>());
-			break;
-		}
+template <class OutputStream>
+class JSONVisitor : public ValueVisitor
+{
+public:
+	explicit JSONVisitor(OutputStream& stream)
+		: _writer(stream)
+	{
+	}
 
-		case Type::Float:
-		{
-			writer.Double(response.get<FloatType>());
-			break;
-		}
+	void startMap(size_t /*count*/) override
+	{
+		_writer.StartObject();
+	}
 
-		case Type::Scalar:
-		{
-			writeResponse(writer, response.release<ScalarType>());
-			break;
-		}
+	void addMember(const std::string& name) override
+	{
+		_writer.Key(name.c_str(), static_cast<rapidjson::SizeType>(name.size()));
+	}
 
-		default:
-		{
-			writer.Null();
-			break;
-		}
+	void endMap() override
+	{
+		_writer.EndObject();
+	}
+
+	void startList(size_t /*count*/) override
+	{
+		_writer.StartArray();
+	}
+
+	void endList() override
+	{
+		_writer.EndArray();
+	}
+
+	void addString(const StringType& value) override
+	{
+		_writer.String(value.c_str(), static_cast<rapidjson::SizeType>(value.size()));
+	}
+
+	void addEnum(const StringType& value) override
+	{
+		addString(value);
+	}
+
+	void addNull() override
+	{
+		_writer.Null();
+	}
+
+	void addBool(BooleanType value) override
+	{
+		_writer.Bool(value);
+	}
+
+	void addInt(IntType value) override
+	{
+		_writer.Int(value);
 	}
+
+	void addFloat(FloatType value) override
+	{
+		_writer.Double(value);
+	}
+
+private:
+	rapidjson::Writer<OutputStream> _writer;
+};
+
+std::string toJSON(const Value& response)
+{
+	std::string output;
+
+	toJSON(response, output);
+	return output;
 }
 
 std::string toJSON(Value&& response)
 {
-	rapidjson::StringBuffer buffer;
-	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	return toJSON(static_cast<const Value&>(response));
+}
+
+void toJSON(const Value& response, std::string& output)
+{
+	StringOutputStream stream { output };
+	JSONVisitor<StringOutputStream> visitor { stream };
+
+	response.visit(visitor);
+}
+
+void toJSON(const Value& response, std::ostream& output)
+{
+	rapidjson::OStreamWrapper stream { output };
+	JSONVisitor<rapidjson::OStreamWrapper> visitor { stream };
+
+	response.visit(visitor);
+	stream.Flush();
+}
+
+void toJSON(
+	const Value& response, const JSONChunkCallback& callback, size_t chunkSize /*= 4096*/)
+{
+	ChunkOutputStream stream { callback, chunkSize };
+	JSONVisitor<ChunkOutputStream> visitor { stream };
 
-	writeResponse(writer, std::move(response));
-	return buffer.GetString();
+	response.visit(visitor);
+	stream.Flush();
 }
 
 struct ResponseHandler : rapidjson::BaseReaderHandler<rapidjson::UTF8<>, ResponseHandler>
@@ -112,14 +198,14 @@ struct ResponseHandler : rapidjson::BaseReaderHandler<rapidjson::UTF8<>, Respons
 	ResponseHandler()
 	{
 		// Start with a single null value.
-		_responseStack.push({});
+		_responseStack.push_back({});
 	}
 
 	Value getResponse()
 	{
-		auto response = std::move(_responseStack.top());
+		auto response = std::move(_responseStack.back().second);
 
-		_responseStack.pop();
+		_responseStack.pop_back();
 
 		return response;
 	}
@@ -178,75 +264,641 @@ struct ResponseHandler : rapidjson::BaseReaderHandler<rapidjson::UTF8<>, Respons
 		return true;
 	}
 
-	bool String(const Ch* str, rapidjson::SizeType /*length*/, bool /*copy*/)
+	bool String(const Ch* str, rapidjson::SizeType length, bool /*copy*/)
 	{
-		setValue(Value(std::string(str)).from_json());
+		setValue(Value(std::string(str, length)).from_json());
 		return true;
 	}
 
 	bool StartObject()
 	{
-		_responseStack.push(Value(Type::Map));
+		_responseStack.push_back({ std::move(_key), Value(Type::Map) });
 		return true;
 	}
 
-	bool Key(const Ch* str, rapidjson::SizeType /*length*/, bool /*copy*/)
+	bool Key(const Ch* str, rapidjson::SizeType length, bool /*copy*/)
 	{
-		_keyStack.push(str);
+		_key.assign(str, length);
 		return true;
 	}
 
 	bool EndObject(rapidjson::SizeType /*count*/)
 	{
-		setValue(getResponse());
+		endValue();
 		return true;
 	}
 
 	bool StartArray()
 	{
-		_responseStack.push(Value(Type::List));
+		_responseStack.push_back({ std::move(_key), Value(Type::List) });
 		return true;
 	}
 
 	bool EndArray(rapidjson::SizeType /*count*/)
 	{
-		setValue(getResponse());
+		endValue();
 		return true;
 	}
 
 private:
+	void endValue()
+	{
+		_key = std::move(_responseStack.back().first);
+		setValue(getResponse());
+	}
+
 	void setValue(Value&& value)
 	{
-		switch (_responseStack.top().type())
+		auto& parent = _responseStack.back().second;
+
+		switch (parent.type())
 		{
 			case Type::Map:
-				_responseStack.top().emplace_back(std::move(_keyStack.top()), std::move(value));
-				_keyStack.pop();
+				parent.emplace_back(std::move(_key), std::move(value));
 				break;
 
 			case Type::List:
-				_responseStack.top().emplace_back(std::move(value));
+				parent.emplace_back(std::move(value));
 				break;
 
 			default:
-				_responseStack.top() = std::move(value);
+				parent = std::move(value);
 				break;
 		}
 	}
 
-	std::stack<std::string> _keyStack;
-	std::stack<Value> _responseStack;
+	// The member name for the next value if the innermost value on the stack is a Map. Each Map or
+	// List on the stack remembers the name it will be added to its own parent with.
+	std::string _key;
+	std::vector<std::pair<std::string, Value>> _responseStack;
 };
 
-Value parseJSON(const std::string& json)
+Value parseJSON(std::string_view json)
+{
+	ResponseHandler handler;
+	rapidjson::Reader reader;
+	rapidjson::MemoryStream ms(json.data(), json.size());
+
+	reader.Parse(ms, handler);
+
+	return handler.getResponse();
+}
+
+Value parseJSONInsitu(std::string&& json)
 {
 	ResponseHandler handler;
 	rapidjson::Reader reader;
-	rapidjson::StringStream ss(json.c_str());
+	rapidjson::InsituStringStream ss(json.data());
 
-	reader.Parse(ss, handler);
+	reader.Parse<rapidjson::kParseInsituFlag>(ss, handler);
 
 	return handler.getResponse();
 }
 
+// Push-mode tokenizer which drives the same ResponseHandler as the RapidJSON Reader. RapidJSON
+// needs the whole document in an input stream before it starts, so this keeps just enough state
+// to resume in the middle of any token when the next piece arrives.
+struct IncrementalParserState
+{
+	enum class Expect
+	{
+		Value,			// Any value
+		ValueOrEnd,		// The first element of an array, or ]
+		KeyOrEnd,		// The first member name of an object, or }
+		Key,			// A member name after a ,
+		Colon,			// The : after a member name
+		SeparatorOrEnd, // A , or the end of the current array or object
+		String,			// Inside of a string value or member name
+		Number,			// Inside of a number
+		Literal,		// Inside of true, false, or null
+		Done,			// Only whitespace may follow the top-level value
+	};
+
+	void push(std::string_view chunk)
+	{
+		size_t position = 0;
+
+		while (position < chunk.size())
+		{
+			position = (expect == Expect::String ? scanString(chunk, position)
+												 : scanToken(chunk, position));
+		}
+
+		offset += chunk.size();
+	}
+
+	Value finish()
+	{
+		if (expect == Expect::Number || expect == Expect::Literal)
+		{
+			endToken();
+		}
+
+		if (expect != Expect::Done)
+		{
+			fail(0, "incomplete JSON document");
+		}
+
+		return handler.getResponse();
+	}
+
+	ResponseHandler handler;
+	Expect expect = Expect::Value;
+	size_t offset = 0;
+
+private:
+	size_t scanToken(std::string_view chunk, size_t position)
+	{
+		const char c = chunk[position];
+
+		switch (expect)
+		{
+			case Expect::Number:
+				if (std::isdigit(static_cast<unsigned char>(c)) || c == '-' || c == '+'
+					|| c == '.' || c == 'e' || c == 'E')
+				{
+					token.push_back(c);
+					return position + 1;
+				}
+
+				// Reprocess the character which ended the number.
+				endToken();
+				return position;
+
+			case Expect::Literal:
+				if (std::isalpha(static_cast<unsigned char>(c)))
+				{
+					token.push_back(c);
+					return position + 1;
+				}
+
+				endToken();
+				return position;
+
+			default:
+				break;
+		}
+
+		if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+		{
+			return position + 1;
+		}
+
+		switch (expect)
+		{
+			case Expect::Value:
+			case Expect::ValueOrEnd:
+				if (c == ']' && expect == Expect::ValueOrEnd)
+				{
+					endContainer(']');
+				}
+				else if (c == '{')
+				{
+					handler.StartObject();
+					containers.push_back('}');
+					expect = Expect::KeyOrEnd;
+				}
+				else if (c == '[')
+				{
+					handler.StartArray();
+					containers.push_back(']');
+					expect = Expect::ValueOrEnd;
+				}
+				else if (c == '"')
+				{
+					startString(false);
+				}
+				else if (c == '-' || std::isdigit(static_cast<unsigned char>(c)))
+				{
+					token.assign(1, c);
+					expect = Expect::Number;
+				}
+				else if (std::isalpha(static_cast<unsigned char>(c)))
+				{
+					token.assign(1, c);
+					expect = Expect::Literal;
+				}
+				else
+				{
+					fail(position, "expected a value");
+				}
+				break;
+
+			case Expect::KeyOrEnd:
+			case Expect::Key:
+				if (c == '}' && expect == Expect::KeyOrEnd)
+				{
+					endContainer('}');
+				}
+				else if (c == '"')
+				{
+					startString(true);
+				}
+				else
+				{
+					fail(position, "expected a member name");
+				}
+				break;
+
+			case Expect::Colon:
+				if (c != ':')
+				{
+					fail(position, "expected :");
+				}
+
+				expect = Expect::Value;
+				break;
+
+			case Expect::SeparatorOrEnd:
+				if (c == ',')
+				{
+					expect = (containers.back() == '}' ? Expect::Key : Expect::Value);
+				}
+				else if (c == containers.back())
+				{
+					endContainer(c);
+				}
+				else
+				{
+					fail(position, "expected , or the end of the array or object");
+				}
+				break;
+
+			case Expect::Done:
+				fail(position, "unexpected data after the end of the JSON document");
+
+			default:
+				break;
+		}
+
+		return position + 1;
+	}
+
+	size_t scanString(std::string_view chunk, size_t position)
+	{
+		if (escape.empty())
+		{
+			// Copy everything up to the next special character at once.
+			const auto end = chunk.find_first_of(R"("\)", position);
+			const auto run = chunk.substr(position, end - position);
+
+			if (std::any_of(run.cbegin(), run.cend(), [](char c) noexcept {
+					return static_cast<unsigned char>(c) < 0x20;
+				}))
+			{
+				fail(position, "unescaped control character in string");
+			}
+
+			if (highSurrogate != 0 && !run.empty())
+			{
+				fail(position, "invalid surrogate pair in string");
+			}
+
+			token.append(run);
+
+			if (end == std::string_view::npos)
+			{
+				return chunk.size();
+			}
+
+			if (chunk[end] == '"')
+			{
+				endString();
+			}
+			else
+			{
+				escape.push_back('\\');
+			}
+
+			return end + 1;
+		}
+
+		escape.push_back(chunk[position]);
+
+		if (escape.size() == 2)
+		{
+			constexpr std::string_view escapes { R"("\/bfnrt)" };
+			constexpr std::string_view replacements { "\"\\/\b\f\n\r\t" };
+			const auto index = escapes.find(escape[1]);
+
+			if (index != std::string_view::npos)
+			{
+				if (highSurrogate != 0)
+				{
+					fail(position, "invalid surrogate pair in string");
+				}
+
+				token.push_back(replacements[index]);
+				escape.clear();
+			}
+			else if (escape[1] != 'u')
+			{
+				fail(position, "invalid escape sequence in string");
+			}
+		}
+		else if (escape.size() == 6)
+		{
+			appendCodePoint(position);
+		}
+
+		return position + 1;
+	}
+
+	void appendCodePoint(size_t position)
+	{
+		uint32_t codePoint = 0;
+
+		for (size_t i = 2; i < escape.size(); ++i)
+		{
+			const char c = escape[i];
+
+			if (!std::isxdigit(static_cast<unsigned char>(c)))
+			{
+				fail(position, "invalid \\u escape sequence in string");
+			}
+
+			codePoint = (codePoint << 4)
+				| static_cast<uint32_t>(std::isdigit(static_cast<unsigned char>(c))
+						? c - '0'
+						: std::tolower(static_cast<unsigned char>(c)) - 'a' + 10);
+		}
+
+		escape.clear();
+
+		if (codePoint >= 0xD800 && codePoint <= 0xDBFF)
+		{
+			// Wait for the low surrogate in the next escape sequence.
+			highSurrogate = codePoint;
+			return;
+		}
+
+		if (codePoint >= 0xDC00 && codePoint <= 0xDFFF)
+		{
+			if (highSurrogate == 0)
+			{
+				fail(position, "invalid surrogate pair in string");
+			}
+
+			codePoint = 0x10000 + ((highSurrogate - 0xD800) << 10) + (codePoint - 0xDC00);
+		}
+		else if (highSurrogate != 0)
+		{
+			fail(position, "invalid surrogate pair in string");
+		}
+
+		highSurrogate = 0;
+
+		if (codePoint < 0x80)
+		{
+			token.push_back(static_cast<char>(codePoint));
+		}
+		else if (codePoint < 0x800)
+		{
+			token.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+			token.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+		}
+		else if (codePoint < 0x10000)
+		{
+			token.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+			token.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+			token.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+		}
+		else
+		{
+			token.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+			token.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+			token.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+			token.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+		}
+	}
+
+	void startString(bool key)
+	{
+		token.clear();
+		isKey = key;
+		expect = Expect::String;
+	}
+
+	void endString()
+	{
+		if (highSurrogate != 0)
+		{
+			fail(0, "invalid surrogate pair in string");
+		}
+
+		const auto length = static_cast<rapidjson::SizeType>(token.size());
+
+		if (isKey)
+		{
+			handler.Key(token.c_str(), length, true);
+			expect = Expect::Colon;
+		}
+		else
+		{
+			handler.String(token.c_str(), length, true);
+			endValue();
+		}
+	}
+
+	void endToken()
+	{
+		if (expect == Expect::Literal)
+		{
+			if (token == "true" || token == "false")
+			{
+				handler.Bool(token == "true");
+			}
+			else if (token == "null")
+			{
+				handler.Null();
+			}
+			else
+			{
+				fail(0, "invalid literal");
+			}
+		}
+		else
+		{
+			endNumber();
+		}
+
+		endValue();
+	}
+
+	// Check the token against the JSON number grammar, since std::from_chars and stream extraction
+	// are more lenient about leading zeroes and they don't require digits around the decimal point.
+	bool isValidNumber() const noexcept
+	{
+		auto itr = token.cbegin();
+		const auto end = token.cend();
+		const auto isDigit = [](char c) noexcept {
+			return c >= '0' && c <= '9';
+		};
+		const auto skipDigits = [&itr, end, &isDigit]() noexcept {
+			const auto first = itr;
+
+			itr = std::find_if_not(itr, end, isDigit);
+			return itr != first;
+		};
+
+		if (itr != end && *itr == '-')
+		{
+			++itr;
+		}
+
+		if (itr != end && *itr == '0')
+		{
+			++itr;
+		}
+		else if (!skipDigits())
+		{
+			return false;
+		}
+
+		if (itr != end && *itr == '.')
+		{
+			++itr;
+
+			if (!skipDigits())
+			{
+				return false;
+			}
+		}
+
+		if (itr != end && (*itr == 'e' || *itr == 'E'))
+		{
+			++itr;
+
+			if (itr != end && (*itr == '+' || *itr == '-'))
+			{
+				++itr;
+			}
+
+			if (!skipDigits())
+			{
+				return false;
+			}
+		}
+
+		return itr == end;
+	}
+
+	// Report numbers the same way as rapidjson::Reader, so the ResponseHandler produces the same
+	// results as parseJSON.
+	void endNumber()
+	{
+		if (!isValidNumber())
+		{
+			fail(0, "invalid number");
+		}
+
+		const auto first = token.c_str();
+		const auto last = first + token.size();
+
+		if (token.find_first_of(".eE") == std::string::npos)
+		{
+			int64_t value = 0;
+
+			if (std::from_chars(first, last, value).ec == std::errc {})
+			{
+				if (value < std::numeric_limits<int>::min()
+					|| value > std::numeric_limits<int>::max())
+				{
+					handler.Int64(value);
+				}
+				else
+				{
+					handler.Int(static_cast<int>(value));
+				}
+
+				return;
+			}
+
+			uint64_t unsignedValue = 0;
+
+			if (token.front() != '-'
+				&& std::from_chars(first, last, unsignedValue).ec == std::errc {})
+			{
+				handler.Uint64(unsignedValue);
+				return;
+			}
+
+			// Integers which don't fit in 64 bits are parsed as a double instead.
+		}
+
+		// Not every standard library supports std::from_chars for floating point types yet, so parse
+		// it with a stream in the "C" locale. That always uses '.' as the decimal point, no matter
+		// what the global locale is.
+		std::istringstream stream { token };
+		double value = 0;
+
+		stream.imbue(std::locale::classic());
+		stream >> value;
+
+		if (stream.fail() || stream.peek() != std::istringstream::traits_type::eof())
+		{
+			fail(0, "invalid number");
+		}
+
+		handler.Double(value);
+	}
+
+	void endContainer(char c)
+	{
+		containers.pop_back();
+
+		if (c == '}')
+		{
+			handler.EndObject(0);
+		}
+		else
+		{
+			handler.EndArray(0);
+		}
+
+		endValue();
+	}
+
+	void endValue()
+	{
+		expect = (containers.empty() ? Expect::Done : Expect::SeparatorOrEnd);
+	}
+
+	[[noreturn]] void fail(size_t position, const char* message) const
+	{
+		std::ostringstream error;
+
+		error << "Invalid JSON at offset: " << (offset + position) << " " << message;
+		throw std::runtime_error(error.str());
+	}
+
+	std::vector<char> containers;
+	std::string token;
+	std::string escape;
+	uint32_t highSurrogate = 0;
+	bool isKey = false;
+};
+
+IncrementalJSONParser::IncrementalJSONParser()
+	: _state(std::make_unique<IncrementalParserState>())
+{
+}
+
+IncrementalJSONParser::~IncrementalJSONParser() = default;
+
+void IncrementalJSONParser::push(std::string_view chunk)
+{
+	_state->push(chunk);
+}
+
+bool IncrementalJSONParser::done() const noexcept
+{
+	return _state->expect == IncrementalParserState::Expect::Done;
+}
+
+Value IncrementalJSONParser::finish()
+{
+	return _state->finish();
+}
+
 } /* namespace graphql::response */
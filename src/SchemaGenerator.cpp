@@ -6,6 +6,7 @@
 #include <boost/program_options.hpp>
 
 #include <cctype>
+#include <charconv>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -558,8 +559,37 @@ void Generator::fixupOutputFieldList(OutputFieldList& fields,
 	const std::optional<std::unordered_set<std::string>>& interfaceFields,
 	const std::optional<std::string_view>& accessor)
 {
+	const bool declaredCacheControl =
+		_directivePositions.find("cacheControl") != _directivePositions.cend();
+
 	for (auto& entry : fields)
 	{
+		// Only honor @cacheControl(maxAge:) hints if the schema declares the directive.
+		if (declaredCacheControl && entry.cacheControlMaxAge)
+		{
+			const auto& maxAge = *entry.cacheControlMaxAge;
+			const auto end = maxAge.data() + maxAge.size();
+			int value = 0;
+			const auto result = std::from_chars(maxAge.data(), end, value);
+
+			if (result.ec != std::errc {} || result.ptr != end || value < 0)
+			{
+				std::ostringstream error;
+
+				error << "Invalid @cacheControl maxAge: " << maxAge << " field: " << entry.name;
+
+				if (entry.position)
+				{
+					error << " line: " << entry.position->line
+						  << " column: " << entry.position->column;
+				}
+
+				throw std::runtime_error(error.str());
+			}
+
+			entry.cacheMaxAge = value;
+		}
+
 		if (interfaceFields)
 		{
 			entry.interfaceField = false;
@@ -1265,6 +1295,30 @@ OutputFieldList Generator::getOutputFields(
 
 							field.deprecationReason = std::move(deprecationReason);
 						}
+						else if (directiveName == "cacheControl")
+						{
+							peg::on_first_child<peg::arguments>(directive,
+								[&field](const peg::ast_node& arguments) {
+									peg::for_each_child<peg::argument>(arguments,
+										[&field](const peg::ast_node& argument) {
+											std::string argumentName;
+
+											peg::on_first_child<peg::argument_name>(argument,
+												[&argumentName](const peg::ast_node& name) {
+													argumentName = name.string_view();
+												});
+
+											if (argumentName == "maxAge")
+											{
+												peg::on_first_child<peg::integer_value>(argument,
+													[&field](const peg::ast_node& maxAge) {
+														field.cacheControlMaxAge =
+															maxAge.string();
+													});
+											}
+										});
+								});
+						}
 					});
 			}
 		}
@@ -2911,6 +2965,13 @@ std::future<response::Value> )cpp"
 			}
 		}
 
+		if (outputField.cacheMaxAge)
+		{
+			sourceFile << R"cpp(	params.hintCacheMaxAge(std::chrono::seconds { )cpp"
+					   << *outputField.cacheMaxAge << R"cpp( });
+)cpp";
+		}
+
 		sourceFile << R"cpp(	std::unique_lock resolverLock(_resolverMutex);
 	auto result = )cpp"
 				   << outputField.accessor << fieldName
@@ -351,8 +351,10 @@ ValidateType ValidateVariableTypeVisitor::getType()
 	return result;
 }
 
-ValidateExecutableVisitor::ValidateExecutableVisitor(const Request& service)
+ValidateExecutableVisitor::ValidateExecutableVisitor(const Request& service, size_t maxErrors)
 	: _service(service)
+	, _maxErrors(std::max(maxErrors, size_t { 1 }))
+	, _maxSelections(service.getMaxSelections())
 {
 	auto data = executeQuery(R"gql(query {
 			__schema {
@@ -744,6 +746,11 @@ void ValidateExecutableVisitor::visit(const peg::ast_node& root)
 	// Visit the executable definitions recursively.
 	for (const auto& child : root.children)
 	{
+		if (hasMaxErrors())
+		{
+			return;
+		}
+
 		if (child->is_type<peg::fragment_definition>())
 		{
 			visitFragmentDefinition(*child);
@@ -761,7 +768,7 @@ void ValidateExecutableVisitor::visit(const peg::ast_node& root)
 		}
 	}
 
-	if (!_fragmentDefinitions.empty())
+	if (!_fragmentDefinitions.empty() && !hasMaxErrors())
 	{
 		// http://spec.graphql.org/June2018/#sec-Fragments-Must-Be-Used
 		const size_t originalSize = _errors.size();
@@ -792,9 +799,39 @@ std::vector<schema_error> ValidateExecutableVisitor::getStructuredErrors()
 {
 	auto errors = std::move(_errors);
 
+	if (errors.size() > _maxErrors)
+	{
+		errors.resize(_maxErrors);
+	}
+
 	return errors;
 }
 
+bool ValidateExecutableVisitor::hasMaxErrors() const noexcept
+{
+	return _errors.size() >= _maxErrors;
+}
+
+bool ValidateExecutableVisitor::countSelection(const peg::ast_node& selection)
+{
+	if (_maxSelections == 0 || ++_selectionCount <= _maxSelections)
+	{
+		return true;
+	}
+
+	if (_selectionCount == _maxSelections + 1)
+	{
+		auto position = selection.begin();
+		std::ostringstream error;
+
+		error << "Too many selections max: " << _maxSelections;
+
+		_errors.push_back({ error.str(), { position.line, position.column } });
+	}
+
+	return false;
+}
+
 void ValidateExecutableVisitor::visitFragmentDefinition(const peg::ast_node& fragmentDefinition)
 {
 	peg::on_first_child<peg::directives>(fragmentDefinition, [this](const peg::ast_node& child) {
@@ -825,6 +862,7 @@ void ValidateExecutableVisitor::visitFragmentDefinition(const peg::ast_node& fra
 
 	_fragmentStack.insert(name);
 	_scopedType = std::move(innerType);
+	_selectionCount = 0;
 
 	visitSelection(selection);
 
@@ -977,6 +1015,7 @@ void ValidateExecutableVisitor::visitOperationDefinition(const peg::ast_node& op
 
 	_scopedType = itrType->second;
 	_fieldCount = 0;
+	_selectionCount = 0;
 
 	const auto& selection = *operationDefinition.children.back();
 
@@ -1025,6 +1064,11 @@ void ValidateExecutableVisitor::visitSelection(const peg::ast_node& selection)
 {
 	for (const auto& child : selection.children)
 	{
+		if (hasMaxErrors() || !countSelection(*child))
+		{
+			return;
+		}
+
 		if (child->is_type<peg::field>())
 		{
 			visitField(*child);
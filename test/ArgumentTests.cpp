@@ -331,3 +331,52 @@ TEST(ArgumentsCase, FindArgumentEmptyTemplateArgs)
 	ASSERT_EQ(response::Type::String, actual.first.type()) << "should parse the object";
 	ASSERT_EQ("foobar", actual.first.get<response::StringType>()) << "should match the value";
 }
+
+TEST(ArgumentsCase, ScalarListResult)
+{
+	auto query = R"({ field })"_graphql;
+	const std::shared_ptr<service::RequestState> state;
+	const response::Value emptyMap(response::Type::Map);
+	const service::FragmentMap fragments;
+	const service::SelectionSetParams selectionSetParams {
+		service::ResolverContext::Query,
+		state,
+		emptyMap,
+		emptyMap,
+		emptyMap,
+		emptyMap,
+		{},
+	};
+	const auto makeParams = [&]() {
+		return service::ResolverParams(selectionSetParams,
+			*query.root,
+			"field",
+			response::Value(response::Type::Map),
+			response::Value(response::Type::Map),
+			nullptr,
+			fragments,
+			emptyMap);
+	};
+
+	auto ints = service::IntResult::convert<service::TypeModifier::List>(
+		std::vector<int> { 1, 2, 3 },
+		makeParams())
+					.get();
+
+	ASSERT_EQ(R"js({"data":[1,2,3]})js", response::toJSON(std::move(ints)));
+
+	auto booleans =
+		service::BooleanResult::convert<service::TypeModifier::List, service::TypeModifier::Nullable>(
+			std::vector<std::optional<bool>> { true, std::nullopt, false },
+			makeParams())
+			.get();
+
+	ASSERT_EQ(R"js({"data":[true,null,false]})js", response::toJSON(std::move(booleans)));
+
+	auto ids = service::IdResult::convert<service::TypeModifier::List>(
+		std::vector<response::IdType> { { 'f', 'a', 'k' } },
+		makeParams())
+				   .get();
+
+	ASSERT_EQ(R"js({"data":["ZmFr"]})js", response::toJSON(std::move(ids)));
+}
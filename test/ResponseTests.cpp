@@ -3,7 +3,13 @@
 
 #include <gtest/gtest.h>
 
+#include "graphqlservice/BinaryResponse.h"
 #include "graphqlservice/GraphQLResponse.h"
+#include "graphqlservice/JSONResponse.h"
+
+#include <limits>
+#include <optional>
+#include <sstream>
 
 using namespace graphql;
 
@@ -15,3 +21,582 @@ TEST(ResponseCase, ValueConstructorFromStringLiteral)
 	ASSERT_TRUE(response::Type::String == actual.type());
 	ASSERT_EQ(expected, actual.release<response::StringType>());
 }
+
+TEST(ResponseCase, ValueMoveLeavesNull)
+{
+	response::Value original(42);
+	response::Value moved(std::move(original));
+
+	ASSERT_TRUE(response::Type::Int == moved.type());
+	ASSERT_EQ(42, moved.get<response::IntType>());
+	ASSERT_TRUE(response::Type::Null == original.type()) << "moved-from Value should be null";
+}
+
+TEST(ResponseCase, ValueCopyIsDeep)
+{
+	response::Value original(response::Type::Map);
+	response::Value list(response::Type::List);
+
+	list.emplace_back(response::Value(true));
+	list.emplace_back(response::Value(1.5));
+	original.emplace_back("list", std::move(list));
+	original.emplace_back("string", response::Value("Test String").from_json());
+
+	response::Value copy(original);
+
+	ASSERT_TRUE(copy == original);
+	ASSERT_TRUE(copy["string"].maybe_enum()) << "should copy the from_json flag";
+
+	original.emplace_back("extra", response::Value());
+
+	ASSERT_FALSE(copy == original) << "should not share the Map with the original";
+	ASSERT_EQ(size_t { 2 }, copy["list"].size());
+}
+
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+	size_t allocations = 0;
+	size_t deallocations = 0;
+
+private:
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		++allocations;
+		return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void* p, size_t bytes, size_t alignment) override
+	{
+		++deallocations;
+		std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+};
+
+TEST(ResponseCase, ValueMemoryResourceScope)
+{
+	CountingResource resource;
+
+	{
+		std::optional<response::Value> map;
+
+		{
+			response::MemoryResourceScope scope(&resource);
+			response::Value list(response::Type::List);
+
+			list.emplace_back(response::Value(1));
+			map = std::make_optional<response::Value>(response::Type::Map);
+			map->emplace_back("list", std::move(list));
+		}
+
+		ASSERT_LT(size_t { 0 }, resource.allocations) << "should allocate from the scoped resource";
+
+		// Values created outside of the scope use the default resource.
+		const auto allocations = resource.allocations;
+		response::Value outside(response::Type::Map);
+
+		outside.emplace_back("map", response::Value(*map));
+		ASSERT_EQ(allocations, resource.allocations);
+	}
+
+	ASSERT_EQ(resource.allocations, resource.deallocations)
+		<< "should free everything back to the resource it came from";
+}
+
+TEST(ResponseCase, ValueFindLargeMap)
+{
+	response::Value map(response::Type::Map);
+
+	for (int i = 0; i < 100; ++i)
+	{
+		map.emplace_back("member" + std::to_string(i), response::Value(i));
+	}
+
+	for (int i = 0; i < 100; ++i)
+	{
+		const auto itr = map.find("member" + std::to_string(i));
+
+		ASSERT_TRUE(itr != map.end()) << "should find every member";
+		ASSERT_EQ(i, itr->second.get<response::IntType>());
+	}
+
+	ASSERT_TRUE(map.find("member100") == map.end()) << "should not find a missing member";
+	ASSERT_THROW(map.emplace_back("member42", response::Value(42)), std::runtime_error)
+		<< "should reject duplicate members";
+
+	const response::Value copy(map);
+
+	ASSERT_EQ(99, copy["member99"].get<response::IntType>()) << "should copy the index";
+}
+
+TEST(ResponseCase, ValueFindSmallMap)
+{
+	response::Value map(response::Type::Map);
+
+	map.emplace_back("a", response::Value(1));
+	map.emplace_back("b", response::Value(2));
+
+	ASSERT_EQ(2, map["b"].get<response::IntType>());
+	ASSERT_TRUE(map.find("c") == map.end()) << "should not find a missing member";
+	ASSERT_THROW(map.emplace_back("a", response::Value(3)), std::runtime_error)
+		<< "should reject duplicate members";
+}
+
+TEST(ResponseCase, ToJSONRepeatedKeys)
+{
+	response::Value list(response::Type::List);
+
+	for (int i = 0; i < 3; ++i)
+	{
+		response::Value entry(response::Type::Map);
+
+		entry.emplace_back("id", response::Value(i));
+		entry.emplace_back("quoted \"key\"", response::Value(true));
+		list.emplace_back(std::move(entry));
+	}
+
+	const auto json = response::toJSON(std::move(list));
+
+	ASSERT_EQ(R"js([{"id":0,"quoted \"key\"":true},{"id":1,"quoted \"key\"":true},{"id":2,"quoted \"key\"":true}])js",
+		json)
+		<< "should escape the repeated keys the same way every time";
+}
+
+class CountingVisitor : public response::ValueVisitor
+{
+public:
+	void startMap(size_t count) override
+	{
+		members += count;
+	}
+
+	void addMember(const std::string& /*name*/) override
+	{
+	}
+
+	void endMap() override
+	{
+	}
+
+	void startList(size_t count) override
+	{
+		elements += count;
+	}
+
+	void endList() override
+	{
+	}
+
+	void addString(const response::StringType& /*value*/) override
+	{
+		++scalars;
+	}
+
+	void addEnum(const response::StringType& /*value*/) override
+	{
+		++scalars;
+	}
+
+	void addNull() override
+	{
+		++scalars;
+	}
+
+	void addBool(response::BooleanType /*value*/) override
+	{
+		++scalars;
+	}
+
+	void addInt(response::IntType /*value*/) override
+	{
+		++scalars;
+	}
+
+	void addFloat(response::FloatType /*value*/) override
+	{
+		++scalars;
+	}
+
+	size_t members = 0;
+	size_t elements = 0;
+	size_t scalars = 0;
+};
+
+TEST(ResponseCase, ValueVisitIsNonDestructive)
+{
+	response::Value map(response::Type::Map);
+	response::Value list(response::Type::List);
+
+	list.emplace_back(response::Value(1));
+	list.emplace_back(response::Value(2.5));
+	map.emplace_back("list", std::move(list));
+	map.emplace_back("string", response::Value("value"));
+
+	const response::Value expected(map);
+
+	for (int i = 0; i < 2; ++i)
+	{
+		CountingVisitor visitor;
+
+		map.visit(visitor);
+		ASSERT_EQ(size_t { 2 }, visitor.members);
+		ASSERT_EQ(size_t { 2 }, visitor.elements);
+		ASSERT_EQ(size_t { 3 }, visitor.scalars);
+	}
+
+	ASSERT_TRUE(expected == map) << "should not modify the Value";
+}
+
+TEST(ResponseCase, ToJSONConstValue)
+{
+	response::Value map(response::Type::Map);
+
+	map.emplace_back("answer", response::Value(42));
+
+	ASSERT_EQ(R"js({"answer":42})js", response::toJSON(map));
+	ASSERT_EQ(R"js({"answer":42})js", response::toJSON(map)) << "should serialize it again";
+	ASSERT_EQ(42, map["answer"].get<response::IntType>()) << "should not release the Value";
+}
+
+TEST(ResponseCase, ToJSONSinks)
+{
+	response::Value list(response::Type::List);
+
+	for (int i = 0; i < 10; ++i)
+	{
+		list.emplace_back(response::Value(i));
+	}
+
+	const auto expected = response::toJSON(list);
+	std::ostringstream stream;
+
+	response::toJSON(list, stream);
+	ASSERT_EQ(expected, stream.str()) << "should write the same JSON to a std::ostream";
+
+	std::string buffer { "prefix:" };
+
+	buffer.reserve(64);
+	response::toJSON(list, buffer);
+	ASSERT_EQ("prefix:" + expected, buffer) << "should append to the buffer";
+
+	std::string chunked;
+	size_t chunks = 0;
+
+	response::toJSON(
+		list,
+		[&chunked, &chunks](std::string_view chunk) {
+			EXPECT_GE(size_t { 4 }, chunk.size()) << "should not exceed the chunk size";
+			chunked.append(chunk);
+			++chunks;
+		},
+		4);
+	ASSERT_EQ(expected, chunked) << "should pass all of the JSON to the callback";
+	ASSERT_EQ((expected.size() + 3) / 4, chunks) << "should fill each chunk before flushing it";
+}
+
+TEST(ResponseCase, ParseJSONStringView)
+{
+	using namespace std::literals;
+
+	// The trailing garbage is outside of the std::string_view, so it should never be read.
+	constexpr auto buffer = R"js({"outer":{"inner":[1,"two\u0000three"]},"after":true}garbage)js"sv;
+	const auto json = buffer.substr(0, buffer.find("garbage"));
+	const auto value = response::parseJSON(json);
+
+	ASSERT_EQ(response::Type::Map, value.type());
+	ASSERT_EQ(size_t { 2 }, value.size());
+	ASSERT_TRUE(value["after"].get<response::BooleanType>()) << "should pop back to the outer Map";
+
+	const auto& inner = value["outer"]["inner"];
+
+	ASSERT_EQ(size_t { 2 }, inner.size());
+	ASSERT_EQ(1, inner[0].get<response::IntType>());
+	ASSERT_EQ("two\0three"s, inner[1].get<response::StringType>())
+		<< "should keep embedded NUL characters";
+}
+
+TEST(ResponseCase, ParseJSONInsitu)
+{
+	std::string json { R"js({"key":"value","list":[{"nested":null}]})js" };
+	const auto expected = response::parseJSON(json);
+	const auto actual = response::parseJSONInsitu(std::move(json));
+
+	ASSERT_TRUE(expected == actual) << "should parse the same Value in place";
+}
+
+TEST(ResponseCase, IncrementalJSONParser)
+{
+	using namespace std::literals;
+
+	constexpr auto json =
+		R"js({ "query": "{ appointments { edges { node { id } } } }", "operationName": null,
+		"variables": { "list": [1, -2, 3.5e2, true, false, "esc\"aped\né😀"],
+		"empty": {}, "none": [] } })js"sv;
+	const auto expected = response::parseJSON(json);
+
+	// Splitting it into single characters splits every token between pieces.
+	response::IncrementalJSONParser parser;
+
+	for (const auto c : json)
+	{
+		ASSERT_FALSE(parser.done()) << "should not finish early";
+		parser.push(std::string_view { &c, 1 });
+	}
+
+	ASSERT_TRUE(parser.done());
+
+	const auto actual = parser.finish();
+
+	ASSERT_TRUE(expected == actual) << "should match parseJSON";
+	ASSERT_EQ("esc\"aped\n\xC3\xA9\xF0\x9F\x98\x80"s,
+		actual["variables"]["list"][5].get<response::StringType>())
+		<< "should decode escape sequences and surrogate pairs";
+}
+
+TEST(ResponseCase, IncrementalJSONParserTopLevelNumber)
+{
+	response::IncrementalJSONParser parser;
+
+	parser.push("12");
+	parser.push("34");
+	ASSERT_FALSE(parser.done()) << "should wait for the end of the number";
+	ASSERT_EQ(1234, parser.finish().get<response::IntType>());
+}
+
+TEST(ResponseCase, IncrementalJSONParserNumbers)
+{
+	{
+		response::IncrementalJSONParser parser;
+
+		parser.push("[-1.5e2, 123456789012345678901234]");
+		const auto actual = parser.finish();
+
+		ASSERT_TRUE(response::parseJSON("[-1.5e2, 123456789012345678901234]") == actual)
+			<< "should match parseJSON";
+		ASSERT_EQ(-150.0, actual[0].get<response::FloatType>());
+		ASSERT_EQ(response::Type::Float, actual[1].type())
+			<< "should parse integers which don't fit in 64 bits as a Float";
+	}
+
+	for (const auto invalid : { "01", "-01", "1.", "-.5", "1e", "+1", "1e400" })
+	{
+		response::IncrementalJSONParser parser;
+
+		ASSERT_THROW(
+			{
+				parser.push(invalid);
+				parser.finish();
+			},
+			std::runtime_error)
+			<< "should reject " << invalid;
+	}
+}
+
+TEST(ResponseCase, IncrementalJSONParserErrors)
+{
+	{
+		response::IncrementalJSONParser parser;
+
+		parser.push(R"js({"key": [1, 2)js");
+		ASSERT_THROW(parser.finish(), std::runtime_error) << "should be incomplete";
+	}
+
+	{
+		response::IncrementalJSONParser parser;
+
+		ASSERT_THROW(parser.push(R"js({"key" 1})js"), std::runtime_error) << "should expect :";
+	}
+
+	{
+		response::IncrementalJSONParser parser;
+
+		parser.push("null");
+		ASSERT_THROW(parser.push(" null"), std::runtime_error)
+			<< "should not allow more than one top-level value";
+	}
+}
+
+response::Value makeBinaryRoundTripValue()
+{
+	response::Value map(response::Type::Map);
+	response::Value list(response::Type::List);
+	response::Value enumValue(response::Type::EnumValue);
+	response::Value scalar(response::Type::Scalar);
+	response::Value scalarMap(response::Type::Map);
+
+	constexpr auto minInt = std::numeric_limits<int>::min();
+	constexpr auto maxInt = std::numeric_limits<int>::max();
+
+	for (const auto value : { 0, 23, 24, 127, 128, 255, 256, 65535, 65536, -1, -32, -33, -128,
+			 -129, -32768, -32769, minInt, maxInt })
+	{
+		list.emplace_back(response::Value(value));
+	}
+
+	list.emplace_back(response::Value(0.5));
+	list.emplace_back(response::Value(true));
+	list.emplace_back(response::Value(false));
+	list.emplace_back(response::Value());
+	list.emplace_back(response::Value(std::string(300, 'x')));
+	enumValue.set<response::StringType>("ENUM_VALUE");
+	scalarMap.emplace_back("nested", response::Value("scalar"));
+	scalar.set<response::ScalarType>(std::move(scalarMap));
+	map.emplace_back("list", std::move(list));
+	map.emplace_back("enum", std::move(enumValue));
+	map.emplace_back("string", response::Value("ENUM_VALUE"));
+	map.emplace_back("scalar", std::move(scalar));
+
+	return map;
+}
+
+TEST(ResponseCase, CBORRoundTrip)
+{
+	const auto expected = makeBinaryRoundTripValue();
+	const auto actual = response::fromCBOR(response::toCBOR(expected));
+
+	ASSERT_TRUE(expected == actual) << "should preserve every Type";
+	ASSERT_EQ(response::Type::EnumValue, actual["enum"].type());
+	ASSERT_EQ(response::Type::String, actual["string"].type());
+	ASSERT_EQ(response::Type::Scalar, actual["scalar"].type());
+}
+
+TEST(ResponseCase, CBORInterop)
+{
+	// An indefinite-length map with a byte string and a half-precision float from another encoder.
+	const std::vector<uint8_t> cbor { 0xBF, 0x62, 'i', 'd', 0x43, 'f', 'a', 'k', 0x61, 'f', 0xF9,
+		0x3C, 0x00, 0xFF };
+	const auto actual = response::fromCBOR(cbor);
+
+	ASSERT_EQ("ZmFr", actual["id"].get<response::StringType>()) << "should encode bytes in Base64";
+	ASSERT_EQ(1.0, actual["f"].get<response::FloatType>());
+	ASSERT_THROW(response::fromCBOR({ 0x1A, 0x80, 0x00, 0x00, 0x00 }), std::overflow_error)
+		<< "should reject integers outside of the range of IntType";
+	ASSERT_THROW(response::fromCBOR({ 0x82, 0x01 }), std::runtime_error)
+		<< "should reject truncated data";
+}
+
+TEST(ResponseCase, MessagePackRoundTrip)
+{
+	const auto expected = makeBinaryRoundTripValue();
+	const auto actual = response::fromMessagePack(response::toMessagePack(expected));
+
+	ASSERT_TRUE(expected == actual) << "should preserve every Type";
+	ASSERT_EQ(response::Type::EnumValue, actual["enum"].type());
+	ASSERT_EQ(response::Type::String, actual["string"].type());
+	ASSERT_EQ(response::Type::Scalar, actual["scalar"].type());
+}
+
+TEST(ResponseCase, MessagePackInterop)
+{
+	// A fixmap with bin 8 and float 32 values from another encoder.
+	const std::vector<uint8_t> messagePack { 0x82, 0xA2, 'i', 'd', 0xC4, 0x03, 'f', 'a', 'k', 0xA1,
+		'f', 0xCA, 0x3F, 0x80, 0x00, 0x00 };
+	const auto actual = response::fromMessagePack(messagePack);
+
+	ASSERT_EQ("ZmFr", actual["id"].get<response::StringType>()) << "should encode bytes in Base64";
+	ASSERT_EQ(1.0, actual["f"].get<response::FloatType>());
+	ASSERT_THROW(response::fromMessagePack({ 0xCE, 0x80, 0x00, 0x00, 0x00 }), std::overflow_error)
+		<< "should reject integers outside of the range of IntType";
+	ASSERT_THROW(response::fromMessagePack({ 0x92, 0x01 }), std::runtime_error)
+		<< "should reject truncated data";
+}
+
+TEST(ResponseCase, MakePatch)
+{
+	const auto from = response::parseJSON(
+		R"js({"data":{"a/b":1,"list":[1,2,3],"same":{"x":"y"},"gone":true,"type":"1"}})js");
+	const auto to = response::parseJSON(
+		R"js({"data":{"a/b":2,"list":[1,5],"same":{"x":"y"},"type":1,"added":[null]}})js");
+	const auto patch = response::makePatch(from, to);
+
+	ASSERT_EQ(
+		R"js([{"op":"replace","path":"/data/a~1b","value":2},{"op":"replace","path":"/data/list/1","value":5},{"op":"remove","path":"/data/list/2"},{"op":"replace","path":"/data/type","value":1},{"op":"add","path":"/data/added","value":[null]},{"op":"remove","path":"/data/gone"}])js",
+		response::toJSON(patch))
+		<< "should only include the differences";
+	ASSERT_EQ(size_t { 0 }, response::makePatch(to, to).size()) << "should be empty";
+
+	response::Value document(from);
+
+	response::applyPatch(document, patch);
+
+	ASSERT_TRUE(document == to) << "should apply every operation";
+	ASSERT_THROW(response::applyPatch(document,
+					 response::parseJSON(R"js([{"op":"remove","path":"/missing"}])js")),
+		std::runtime_error)
+		<< "should reject paths which don't exist";
+}
+
+TEST(ResponseCase, ApplyPatchErrors)
+{
+	const auto original = response::parseJSON(R"js({"data":{"list":[1,2],"value":"x"}})js");
+	response::Value document(original);
+
+	ASSERT_THROW(response::applyPatch(document,
+					 response::parseJSON(
+						 R"js([{"op":"remove","path":"/data/list/0"},{"op":"replace","path":"/data/missing","value":1}])js")),
+		std::runtime_error)
+		<< "should not replace a member which doesn't exist";
+	ASSERT_TRUE(document == original) << "should leave the document unchanged after an error";
+	ASSERT_THROW(response::applyPatch(document,
+					 response::parseJSON(
+						 R"js([{"op":"add","path":"/data/list/0","value":0},{"op":"remove","path":"/data/value"},{"op":"replace","path":"/data/list/1","value":3},{"op":"add","path":"/data/new","value":4},{"op":"replace","path":"","value":{}},{"op":"remove","path":"/data"}])js")),
+		std::runtime_error)
+		<< "should not remove a member of the replaced document";
+	ASSERT_TRUE(document == original) << "should reverse every operation after an error";
+	ASSERT_THROW(response::applyPatch(document,
+					 response::parseJSON(R"js([{"op":"add","path":"/data/a~2b","value":1}])js")),
+		std::runtime_error)
+		<< "should reject an unknown escape sequence";
+	ASSERT_THROW(response::applyPatch(document,
+					 response::parseJSON(R"js([{"op":"add","path":"/data/a~","value":1}])js")),
+		std::runtime_error)
+		<< "should reject a trailing ~";
+	ASSERT_TRUE(document == original) << "should leave the document unchanged after a bad path";
+	ASSERT_THROW(response::applyPatch(document,
+					 response::parseJSON(R"js([{"op":"add","path":"/data/list/01","value":1}])js")),
+		std::runtime_error)
+		<< "should not allow leading zeroes in an index";
+	ASSERT_THROW(response::applyPatch(document,
+					 response::parseJSON(
+						 R"js([{"op":"add","path":"/data/list/99999999999999999999999","value":1}])js")),
+		std::runtime_error)
+		<< "should reject an index which doesn't fit in size_t";
+}
+
+TEST(ResponseCase, ApplyPatchIndexedMap)
+{
+	response::Value from(response::Type::Map);
+	response::Value to(response::Type::Map);
+
+	for (int i = 0; i < 20; ++i)
+	{
+		from.emplace_back("member" + std::to_string(i), response::Value(i));
+
+		if (i != 3)
+		{
+			to.emplace_back("member" + std::to_string(i), response::Value(i == 10 ? -1 : i));
+		}
+	}
+
+	response::applyPatch(from, response::makePatch(from, to));
+
+	ASSERT_TRUE(from == to) << "should apply every operation";
+	ASSERT_TRUE(from.find("member3") == from.end()) << "should remove the member from the index";
+	ASSERT_EQ(19, from["member19"].get<response::IntType>())
+		<< "should find the members after the removed one";
+	ASSERT_EQ(-1, from["member10"].get<response::IntType>()) << "should replace in place";
+	ASSERT_THROW(response::applyPatch(from,
+					 response::parseJSON(
+						 R"js([{"op":"remove","path":"/member5"},{"op":"add","path":"/extra","value":1},{"op":"remove","path":"/member3"}])js")),
+		std::runtime_error)
+		<< "should not remove a member which doesn't exist";
+	ASSERT_TRUE(from == to) << "should put the removed member back";
+	ASSERT_TRUE(from.find("extra") == from.end()) << "should remove the added member from the index";
+	ASSERT_EQ(19, from["member19"].get<response::IntType>())
+		<< "should find the members after the restored one";
+}
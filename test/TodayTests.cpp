@@ -7,7 +7,9 @@
 
 #include "graphqlservice/JSONResponse.h"
 
+#include <algorithm>
 #include <chrono>
+#include <thread>
 
 using namespace graphql;
 
@@ -476,6 +478,546 @@ TEST_F(TodayServiceCase, SubscribeNextAppointmentChangeOverride)
 	}
 }
 
+TEST_F(TodayServiceCase, SubscribeConcurrentDeliver)
+{
+	auto subscriptionObject = std::make_shared<today::NextAppointmentChange>(
+		[this](const std::shared_ptr<service::RequestState>&) -> std::shared_ptr<today::Appointment>
+	{
+		return std::make_shared<today::Appointment>(response::IdType(_fakeAppointmentId), "today", "Dinner Time!", true);
+	});
+	std::vector<std::thread> clients;
+
+	for (size_t i = 0; i < 4; ++i)
+	{
+		clients.emplace_back([]()
+		{
+			for (size_t j = 0; j < 50; ++j)
+			{
+				auto key = _service->subscribe(service::SubscriptionParams { nullptr, peg::parseString(R"(subscription {
+						nextAppointmentChange {
+							subject
+						}
+					})"), "", response::Value(response::Type::Map) },
+					[](std::future<response::Value> response)
+				{
+					response.get();
+				});
+
+				_service->unsubscribe(key);
+			}
+		});
+	}
+
+	size_t calledUnsubscribe = 0;
+	std::vector<service::SubscriptionKey> keys;
+
+	// A callback which unsubscribes itself should not interfere with the rest of the delivery.
+	for (size_t i = 0; i < 2; ++i)
+	{
+		keys.push_back(_service->subscribe(service::SubscriptionParams { nullptr, peg::parseString(R"(subscription {
+				nextAppointmentChange {
+					subject
+				}
+			})"), "", response::Value(response::Type::Map) },
+			[&keys, &calledUnsubscribe, i](std::future<response::Value> response)
+		{
+			response.get();
+			_service->unsubscribe(keys[i]);
+			++calledUnsubscribe;
+		}));
+	}
+
+	for (size_t i = 0; i < 50; ++i)
+	{
+		_service->deliver("nextAppointmentChange", std::static_pointer_cast<service::Object>(subscriptionObject));
+	}
+
+	for (auto& client : clients)
+	{
+		client.join();
+	}
+
+	EXPECT_EQ(2, calledUnsubscribe) << "should deliver once to each subscription which unsubscribes itself";
+}
+
+TEST_F(TodayServiceCase, SubscribeShardedDeliver)
+{
+	std::vector<std::vector<std::string>> subjects(6);
+	std::vector<service::SubscriptionKey> keys;
+
+	_service->setDeliveryShards(3);
+
+	for (auto& received : subjects)
+	{
+		keys.push_back(_service->subscribe(service::SubscriptionParams { nullptr, peg::parseString(R"(subscription {
+				nextAppointmentChange {
+					subject
+				}
+			})"), "", response::Value(response::Type::Map) },
+			[&received](std::future<response::Value> response)
+		{
+			const auto result = response.get();
+			const auto data = service::ScalarArgument::require("data", result);
+			const auto appointmentNode = service::ScalarArgument::require("nextAppointmentChange", data);
+
+			received.push_back(service::StringArgument::require("subject", appointmentNode));
+		}));
+	}
+
+	for (size_t i = 0; i < 5; ++i)
+	{
+		auto subscriptionObject = std::make_shared<today::NextAppointmentChange>(
+			[this, i](const std::shared_ptr<service::RequestState>&) -> std::shared_ptr<today::Appointment>
+		{
+			return std::make_shared<today::Appointment>(response::IdType(_fakeAppointmentId), "today", std::to_string(i), true);
+		});
+
+		_service->deliver(std::launch::async, "nextAppointmentChange", std::static_pointer_cast<service::Object>(subscriptionObject));
+	}
+
+	_service->setDeliveryShards(1);
+
+	for (const auto key : keys)
+	{
+		_service->unsubscribe(key);
+	}
+
+	const std::vector<std::string> expected { "0", "1", "2", "3", "4" };
+
+	for (const auto& received : subjects)
+	{
+		EXPECT_EQ(expected, received) << "each subscription should receive every event in order";
+	}
+}
+
+TEST_F(TodayServiceCase, SubscribeShardAssignment)
+{
+	std::vector<service::SubscriptionKey> delivered;
+	std::vector<service::SubscriptionKey> keys;
+
+	_service->setDeliveryShards(3);
+
+	for (size_t i = 0; i < 6; ++i)
+	{
+		auto key = std::make_shared<service::SubscriptionKey>(0);
+
+		keys.push_back(_service->subscribe(service::SubscriptionParams { nullptr, peg::parseString(R"(subscription {
+				nextAppointmentChange {
+					subject
+				}
+			})"), "", response::Value(response::Type::Map) },
+			[&delivered, key](std::future<response::Value> response)
+		{
+			response.get();
+			delivered.push_back(*key);
+		}));
+		*key = keys.back();
+	}
+
+	auto subscriptionObject = std::make_shared<today::NextAppointmentChange>(
+		[this](const std::shared_ptr<service::RequestState>&) -> std::shared_ptr<today::Appointment>
+	{
+		return std::make_shared<today::Appointment>(response::IdType(_fakeAppointmentId), "today", "Shards", true);
+	});
+
+	// With std::launch::deferred, each shard is delivered in turn on this thread, so the callbacks
+	// run in key order within each shard, one shard after another.
+	_service->deliver(std::launch::deferred, "nextAppointmentChange", std::static_pointer_cast<service::Object>(subscriptionObject));
+	_service->setDeliveryShards(1);
+
+	for (const auto key : keys)
+	{
+		_service->unsubscribe(key);
+	}
+
+	auto expected = keys;
+
+	std::stable_sort(expected.begin(), expected.end(), [](service::SubscriptionKey lhs, service::SubscriptionKey rhs) noexcept {
+		return lhs % 3 < rhs % 3;
+	});
+
+	EXPECT_EQ(expected, delivered) << "should assign each subscription to a shard by its key";
+}
+
+TEST_F(TodayServiceCase, SubscribeKeysNotReused)
+{
+	std::vector<service::SubscriptionKey> keys;
+
+	for (size_t i = 0; i < 2; ++i)
+	{
+		keys.push_back(_service->subscribe(service::SubscriptionParams { nullptr, peg::parseString(R"(subscription {
+				nextAppointmentChange {
+					subject
+				}
+			})"), "", response::Value(response::Type::Map) },
+			[](std::future<response::Value> response)
+		{
+			response.get();
+		}));
+
+		// Another thread could still be holding onto this key, so the next one should be new.
+		_service->unsubscribe(keys.back());
+	}
+
+	EXPECT_NE(keys[0], keys[1]) << "should not reuse the key of a removed subscription";
+}
+
+std::vector<std::string> deliverQueuedEvents(const std::shared_ptr<service::Request>& service, service::SubscriptionOverflow overflow, const response::IdType& appointmentId)
+{
+	auto dispatcher = std::make_unique<service::SubscriptionDispatcher>(service, 2, 2, overflow);
+	std::vector<std::string> subjects;
+	std::promise<void> blocked;
+	std::promise<void> gate;
+	auto waitForGate = gate.get_future().share();
+	auto key = dispatcher->subscribe(service::SubscriptionParams { nullptr, peg::parseString(R"(subscription {
+			nextAppointmentChange {
+				subject
+			}
+		})"), "", response::Value(response::Type::Map) },
+		[&subjects, &blocked, waitForGate](std::future<response::Value> response)
+	{
+		const auto result = response.get();
+
+		if (result.find("errors") != result.end())
+		{
+			subjects.push_back("error");
+			return;
+		}
+
+		const auto data = service::ScalarArgument::require("data", result);
+		const auto appointmentNode = service::ScalarArgument::require("nextAppointmentChange", data);
+
+		subjects.push_back(service::StringArgument::require("subject", appointmentNode));
+
+		// Hold up the callback for the first result until all of the other events are queued.
+		if (subjects.size() == 1)
+		{
+			blocked.set_value();
+			waitForGate.wait();
+		}
+	});
+	// Release the blocked callback as soon as all of the events before this one are delivered.
+	auto sentinelKey = service->subscribe(service::SubscriptionParams { nullptr, peg::parseString(R"(subscription {
+			nodeChange(id: "c2VudGluZWw=") {
+				id
+			}
+		})"), "", response::Value(response::Type::Map) },
+		[&gate](std::future<response::Value>)
+	{
+		gate.set_value();
+	});
+	const auto deliverSubject = [&dispatcher, &appointmentId](size_t i) {
+		dispatcher->deliver("nextAppointmentChange", std::make_shared<today::NextAppointmentChange>(
+			[i, appointmentId](const std::shared_ptr<service::RequestState>&) -> std::shared_ptr<today::Appointment>
+		{
+			return std::make_shared<today::Appointment>(response::IdType(appointmentId), "today", std::to_string(i), false);
+		}));
+	};
+
+	deliverSubject(0);
+	blocked.get_future().wait();
+
+	for (size_t i = 1; i < 6; ++i)
+	{
+		deliverSubject(i);
+	}
+
+	// The events are delivered in order, so by the time the other worker delivers this one, every
+	// result has been added to the queue for the blocked callback.
+	dispatcher->deliver("nodeChange", [](response::MapType::const_reference) noexcept
+	{
+		return true;
+	}, std::make_shared<today::NodeChange>(
+		[](const std::shared_ptr<service::RequestState>&, response::IdType&&) -> std::shared_ptr<service::Object>
+	{
+		return nullptr;
+	}));
+
+	dispatcher->flush();
+	service->unsubscribe(sentinelKey);
+	dispatcher->unsubscribe(key);
+
+	return subjects;
+}
+
+TEST_F(TodayServiceCase, SubscriptionDispatcherDropOldest)
+{
+	const auto subjects = deliverQueuedEvents(_service, service::SubscriptionOverflow::DropOldest, _fakeAppointmentId);
+
+	EXPECT_EQ((std::vector<std::string> { "0", "4", "5" }), subjects) << "should only keep the newest results";
+}
+
+TEST_F(TodayServiceCase, SubscriptionDispatcherCoalesce)
+{
+	const auto subjects = deliverQueuedEvents(_service, service::SubscriptionOverflow::Coalesce, _fakeAppointmentId);
+
+	EXPECT_EQ((std::vector<std::string> { "0", "5" }), subjects) << "should replace the pending results";
+}
+
+TEST_F(TodayServiceCase, SubscriptionDispatcherOrdered)
+{
+	auto dispatcher = std::make_unique<service::SubscriptionDispatcher>(_service, 4, 32);
+	std::vector<std::string> subjects;
+	std::vector<std::string> expected;
+	auto key = dispatcher->subscribe(service::SubscriptionParams { nullptr, peg::parseString(R"(subscription {
+			nextAppointmentChange {
+				subject
+			}
+		})"), "", response::Value(response::Type::Map) },
+		[&subjects](std::future<response::Value> response)
+	{
+		const auto result = response.get();
+		const auto data = service::ScalarArgument::require("data", result);
+		const auto appointmentNode = service::ScalarArgument::require("nextAppointmentChange", data);
+
+		subjects.push_back(service::StringArgument::require("subject", appointmentNode));
+	});
+
+	// Make the earlier events slower to resolve, so they would finish last if they ran in parallel.
+	for (size_t i = 0; i < 8; ++i)
+	{
+		expected.push_back(std::to_string(i));
+		dispatcher->deliver("nextAppointmentChange", std::make_shared<today::NextAppointmentChange>(
+			[this, i](const std::shared_ptr<service::RequestState>&) -> std::shared_ptr<today::Appointment>
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(8 - i));
+			return std::make_shared<today::Appointment>(response::IdType(_fakeAppointmentId), "today", std::to_string(i), false);
+		}));
+	}
+
+	dispatcher->flush();
+	dispatcher->unsubscribe(key);
+
+	EXPECT_EQ(expected, subjects) << "should deliver the events in order with multiple workers";
+}
+
+TEST_F(TodayServiceCase, SubscriptionDispatcherDisconnect)
+{
+	const auto subjects = deliverQueuedEvents(_service, service::SubscriptionOverflow::Disconnect, _fakeAppointmentId);
+
+	EXPECT_EQ((std::vector<std::string> { "0", "error" }), subjects) << "should disconnect after an error";
+}
+
+TEST_F(TodayServiceCase, SubscriptionDispatcherBoundedEvents)
+{
+	auto dispatcher = std::make_unique<service::SubscriptionDispatcher>(_service, 1, 16, service::SubscriptionOverflow::DropOldest, 1);
+	std::vector<std::string> subjects;
+	auto key = dispatcher->subscribe(service::SubscriptionParams { nullptr, peg::parseString(R"(subscription {
+			nextAppointmentChange {
+				subject
+			}
+		})"), "", response::Value(response::Type::Map) },
+		[&subjects](std::future<response::Value> response)
+	{
+		const auto result = response.get();
+		const auto data = service::ScalarArgument::require("data", result);
+		const auto appointmentNode = service::ScalarArgument::require("nextAppointmentChange", data);
+
+		subjects.push_back(service::StringArgument::require("subject", appointmentNode));
+	});
+	std::promise<void> started;
+	std::promise<void> gate;
+	auto waitForGate = gate.get_future().share();
+	const auto deliverSubject = [this, &dispatcher, &started, waitForGate](size_t i) {
+		dispatcher->deliver("nextAppointmentChange", std::make_shared<today::NextAppointmentChange>(
+			[this, i, &started, waitForGate](const std::shared_ptr<service::RequestState>&) -> std::shared_ptr<today::Appointment>
+		{
+			// Hold up the only worker thread while it's delivering the first event.
+			if (i == 0)
+			{
+				started.set_value();
+				waitForGate.wait();
+			}
+
+			return std::make_shared<today::Appointment>(response::IdType(_fakeAppointmentId), "today", std::to_string(i), false);
+		}));
+	};
+
+	deliverSubject(0);
+	started.get_future().wait();
+	deliverSubject(1);
+
+	auto blocked = std::async(std::launch::async, [&deliverSubject]() {
+		deliverSubject(2);
+	});
+
+	EXPECT_EQ(std::future_status::timeout, blocked.wait_for(std::chrono::milliseconds(20))) << "should wait for room in the queue";
+
+	gate.set_value();
+	blocked.get();
+	dispatcher->flush();
+	dispatcher->unsubscribe(key);
+
+	EXPECT_EQ((std::vector<std::string> { "0", "1", "2" }), subjects) << "should deliver every event after waiting";
+}
+
+TEST_F(TodayServiceCase, SubscriptionDispatcherRejectsDelta)
+{
+	service::SubscriptionDispatcher dispatcher(_service);
+
+	EXPECT_THROW(dispatcher.subscribe(service::SubscriptionParams { nullptr, peg::parseString(R"(subscription {
+			nextAppointmentChange {
+				subject
+			}
+		})"), "", response::Value(response::Type::Map), std::chrono::milliseconds(0), false, 2 },
+		[](std::future<response::Value>)
+	{
+	}), std::logic_error) << "should not queue delta payloads which might be dropped";
+}
+
+TEST_F(TodayServiceCase, SubscribeNextAppointmentChangeGrouped)
+{
+	constexpr auto document = R"(subscription TestSubscription {
+			nextAppointment: nextAppointmentChange {
+				nextAppointmentId: id
+				subject
+			}
+		})";
+	size_t calledResolver = 0;
+	auto subscriptionObject = std::make_shared<today::NextAppointmentChange>(
+		[this, &calledResolver](const std::shared_ptr<service::RequestState>&) -> std::shared_ptr<today::Appointment>
+	{
+		++calledResolver;
+		return std::make_shared<today::Appointment>(response::IdType(_fakeAppointmentId), "today", "Dinner Time!", true);
+	});
+	std::vector<std::string> subjects;
+	std::vector<service::SubscriptionKey> keys;
+
+	_service->setGroupSubscriptions(true);
+
+	for (const auto& query : { document, document, R"(subscription TestSubscription {
+			nextAppointment: nextAppointmentChange {
+				subject
+			}
+		})" })
+	{
+		keys.push_back(_service->subscribe(service::SubscriptionParams { std::make_shared<today::RequestState>(8), peg::parseString(query), "TestSubscription", response::Value(response::Type::Map) },
+			[&subjects](std::future<response::Value> response)
+		{
+			const auto result = response.get();
+			const auto data = service::ScalarArgument::require("data", result);
+			const auto appointmentNode = service::ScalarArgument::require("nextAppointment", data);
+
+			subjects.push_back(service::StringArgument::require("subject", appointmentNode));
+		}));
+	}
+
+	_service->setGroupSubscriptions(false);
+	_service->deliver("nextAppointmentChange", std::static_pointer_cast<service::Object>(subscriptionObject));
+
+	for (const auto key : keys)
+	{
+		_service->unsubscribe(key);
+	}
+
+	EXPECT_EQ(2, calledResolver) << "should resolve each distinct subscription once";
+	ASSERT_EQ(3, subjects.size()) << "should invoke every callback";
+	for (const auto& subject : subjects)
+	{
+		EXPECT_EQ("Dinner Time!", subject) << "subject should match";
+	}
+}
+
+TEST_F(TodayServiceCase, SubscribeNextAppointmentChangeSharedDocument)
+{
+	constexpr auto document = R"(subscription TestSubscription {
+			nextAppointment: nextAppointmentChange {
+				...AppointmentFragment
+			}
+		}
+
+		fragment AppointmentFragment on Appointment {
+			nextAppointmentId: id
+			subject
+		})";
+	auto subscriptionObject = std::make_shared<today::NextAppointmentChange>(
+		[this](const std::shared_ptr<service::RequestState>&) -> std::shared_ptr<today::Appointment>
+	{
+		return std::make_shared<today::Appointment>(response::IdType(_fakeAppointmentId), "today", "Dinner Time!", true);
+	});
+	std::vector<std::string> subjects;
+	auto callback = [&subjects](std::future<response::Value> response)
+	{
+		const auto result = response.get();
+		const auto data = service::ScalarArgument::require("data", result);
+		const auto appointmentNode = service::ScalarArgument::require("nextAppointment", data);
+
+		subjects.push_back(service::StringArgument::require("subject", appointmentNode));
+	};
+	auto firstQuery = peg::parseString(document);
+	std::weak_ptr<peg::ast_node> firstRoot = firstQuery.root;
+	auto firstKey = _service->subscribe(service::SubscriptionParams { std::make_shared<today::RequestState>(9), std::move(firstQuery), "TestSubscription", response::Value(response::Type::Map) },
+		callback);
+	auto secondKey = _service->subscribe(service::SubscriptionParams { std::make_shared<today::RequestState>(10), peg::parseString(document), "TestSubscription", response::Value(response::Type::Map) },
+		callback);
+
+	_service->unsubscribe(firstKey);
+
+	EXPECT_FALSE(firstRoot.expired()) << "second subscription should share the first document";
+
+	_service->deliver("nextAppointmentChange", std::static_pointer_cast<service::Object>(subscriptionObject));
+	_service->unsubscribe(secondKey);
+
+	EXPECT_TRUE(firstRoot.expired()) << "shared document should be released with the last subscription";
+	ASSERT_EQ(1, subjects.size()) << "should invoke the remaining callback";
+	EXPECT_EQ("Dinner Time!", subjects.front()) << "subject should match";
+}
+
+TEST_F(TodayServiceCase, SubscribeNodeChangeSharedDocumentVariables)
+{
+	constexpr auto document = R"(subscription TestSubscription($nodeId: ID!) {
+			changedNode: nodeChange(id: $nodeId) {
+				changedId: id
+			}
+		})";
+	auto subscriptionObject = std::make_shared<today::NodeChange>(
+		[](const std::shared_ptr<service::RequestState>&, response::IdType&& idArg) -> std::shared_ptr<service::Object>
+	{
+		return std::static_pointer_cast<service::Object>(std::make_shared<today::Task>(std::move(idArg), "Don't forget", true));
+	});
+	std::vector<std::pair<size_t, response::IdType>> received;
+	const auto makeCallback = [&received](size_t subscription)
+	{
+		return [&received, subscription](std::future<response::Value> response)
+		{
+			const auto result = response.get();
+			const auto data = service::ScalarArgument::require("data", result);
+			const auto taskNode = service::ScalarArgument::require("changedNode", data);
+
+			received.emplace_back(subscription, service::IdArgument::require("changedId", taskNode));
+		};
+	};
+	const auto makeVariables = [](const char* nodeId)
+	{
+		response::Value variables(response::Type::Map);
+
+		variables.emplace_back("nodeId", response::Value(std::string(nodeId)));
+
+		return variables;
+	};
+	auto firstQuery = peg::parseString(document);
+	std::weak_ptr<peg::ast_node> firstRoot = firstQuery.root;
+	auto firstKey = _service->subscribe(service::SubscriptionParams { nullptr, std::move(firstQuery), "TestSubscription", makeVariables("ZmFrZVRhc2tJZA==") },
+		makeCallback(1));
+	auto secondKey = _service->subscribe(service::SubscriptionParams { nullptr, peg::parseString(document), "TestSubscription", makeVariables("ZmFrZUFwcG9pbnRtZW50SWQ=") },
+		makeCallback(2));
+
+	_service->deliver("nodeChange", { { "id", response::Value(std::string("ZmFrZVRhc2tJZA==")) } }, std::static_pointer_cast<service::Object>(subscriptionObject));
+	_service->unsubscribe(firstKey);
+
+	EXPECT_FALSE(firstRoot.expired()) << "subscriptions with different variables should share the document";
+
+	_service->deliver("nodeChange", { { "id", response::Value(std::string("ZmFrZUFwcG9pbnRtZW50SWQ=")) } }, std::static_pointer_cast<service::Object>(subscriptionObject));
+	_service->unsubscribe(secondKey);
+
+	EXPECT_TRUE(firstRoot.expired()) << "shared document should be released with the last subscription";
+	ASSERT_EQ(2, received.size()) << "each event should only match one subscription";
+	EXPECT_EQ(1, received[0].first) << "first event should match the first subscription";
+	EXPECT_EQ(_fakeTaskId, received[0].second) << "first subscription should use its own variables";
+	EXPECT_EQ(2, received[1].first) << "second event should match the second subscription";
+	EXPECT_EQ(_fakeAppointmentId, received[1].second) << "second subscription should use its own variables";
+}
+
 TEST_F(TodayServiceCase, Introspection)
 {
 	auto query = R"({
@@ -866,6 +1408,148 @@ TEST_F(TodayServiceCase, UnimplementedFieldError)
 	}
 }
 
+TEST_F(TodayServiceCase, SubscribeNextAppointmentChangeSerialized)
+{
+	auto subscriptionObject = std::make_shared<today::NextAppointmentChange>(
+		[this](const std::shared_ptr<service::RequestState>&) -> std::shared_ptr<today::Appointment>
+	{
+		return std::make_shared<today::Appointment>(response::IdType(_fakeAppointmentId), "today", "Dinner Time!", true);
+	});
+	size_t calledSerialize = 0;
+	std::vector<std::shared_ptr<const std::string>> payloads;
+	std::vector<service::SubscriptionKey> keys;
+
+	_service->setGroupSubscriptions(true);
+	_service->setSubscriptionSerializer([&calledSerialize](response::Value&& document)
+	{
+		++calledSerialize;
+		return response::toJSON(std::move(document));
+	});
+
+	for (size_t i = 0; i < 3; ++i)
+	{
+		keys.push_back(_service->subscribe(service::SubscriptionParams { nullptr, peg::parseString(R"(subscription {
+				nextAppointmentChange {
+					subject
+				}
+			})"), "", response::Value(response::Type::Map) },
+			service::SerializedSubscriptionCallback { [&payloads](std::future<std::shared_ptr<const std::string>> payload)
+		{
+			payloads.push_back(payload.get());
+		} }));
+	}
+
+	_service->setGroupSubscriptions(false);
+	_service->deliver("nextAppointmentChange", std::static_pointer_cast<service::Object>(subscriptionObject));
+
+	for (const auto key : keys)
+	{
+		_service->unsubscribe(key);
+	}
+
+	_service->setSubscriptionSerializer({});
+
+	EXPECT_EQ(1, calledSerialize) << "should serialize the shared result once";
+	ASSERT_EQ(3, payloads.size()) << "should invoke every callback";
+	EXPECT_EQ(payloads[0], payloads[1]) << "should share the same buffer";
+	EXPECT_EQ(payloads[0], payloads[2]) << "should share the same buffer";
+	EXPECT_EQ(R"js({"data":{"nextAppointmentChange":{"subject":"Dinner Time!"}}})js", *payloads[0]) << "should match the serialized result";
+}
+
+TEST_F(TodayServiceCase, SubscribeNextAppointmentChangeThrottled)
+{
+	size_t calledResolver = 0;
+	std::vector<std::string> coalescedSubjects;
+	std::vector<std::string> droppedSubjects;
+	auto now = std::chrono::steady_clock::now();
+
+	// Control the time, so it doesn't depend on how long each call takes.
+	_service->setSubscriptionClock([&now]() noexcept
+	{
+		return now;
+	});
+
+	const auto subscribe = [](bool coalesce, std::vector<std::string>& subjects)
+	{
+		return _service->subscribe(service::SubscriptionParams { nullptr, peg::parseString(R"(subscription {
+				nextAppointmentChange {
+					subject
+				}
+			})"), "", response::Value(response::Type::Map), std::chrono::milliseconds(250), coalesce },
+			[&subjects](std::future<response::Value> response)
+		{
+			const auto result = response.get();
+			const auto data = service::ScalarArgument::require("data", result);
+			const auto appointmentNode = service::ScalarArgument::require("nextAppointmentChange", data);
+
+			subjects.push_back(service::StringArgument::require("subject", appointmentNode));
+		});
+	};
+	const auto coalescedKey = subscribe(true, coalescedSubjects);
+	const auto droppedKey = subscribe(false, droppedSubjects);
+
+	for (size_t i = 0; i < 3; ++i)
+	{
+		_service->deliver("nextAppointmentChange", std::make_shared<today::NextAppointmentChange>(
+			[this, i, &calledResolver](const std::shared_ptr<service::RequestState>&) -> std::shared_ptr<today::Appointment>
+		{
+			++calledResolver;
+			return std::make_shared<today::Appointment>(response::IdType(_fakeAppointmentId), "today", std::to_string(i), false);
+		}));
+	}
+
+	now += std::chrono::milliseconds(100);
+
+	const auto nextPending = _service->deliverPending();
+
+	EXPECT_EQ(2, calledResolver) << "should only resolve the first event for each subscription";
+	ASSERT_TRUE(nextPending.has_value()) << "should hold onto the latest event";
+	EXPECT_EQ(now + std::chrono::milliseconds(150), *nextPending) << "should be ready after minInterval";
+
+	now = *nextPending;
+
+	EXPECT_FALSE(_service->deliverPending().has_value()) << "should not have any more pending events";
+
+	_service->unsubscribe(coalescedKey);
+	_service->unsubscribe(droppedKey);
+	_service->setSubscriptionClock({});
+
+	EXPECT_EQ(3, calledResolver) << "should resolve the coalesced event once";
+	EXPECT_EQ((std::vector<std::string> { "0", "2" }), coalescedSubjects) << "should deliver the latest event";
+	EXPECT_EQ((std::vector<std::string> { "0" }), droppedSubjects) << "should drop the other events";
+}
+
+TEST_F(TodayServiceCase, SubscribeNextAppointmentChangeDelta)
+{
+	std::vector<std::string> payloads;
+	auto key = _service->subscribe(service::SubscriptionParams { nullptr, peg::parseString(R"(subscription {
+			nextAppointmentChange {
+				when
+				subject
+			}
+		})"), "", response::Value(response::Type::Map), std::chrono::milliseconds(0), false, 2 },
+		[&payloads](std::future<response::Value> response)
+	{
+		payloads.push_back(response::toJSON(response.get()));
+	});
+
+	for (size_t i = 0; i < 3; ++i)
+	{
+		_service->deliver("nextAppointmentChange", std::make_shared<today::NextAppointmentChange>(
+			[this, i](const std::shared_ptr<service::RequestState>&) -> std::shared_ptr<today::Appointment>
+		{
+			return std::make_shared<today::Appointment>(response::IdType(_fakeAppointmentId), "today", std::to_string(i), false);
+		}));
+	}
+
+	_service->unsubscribe(key);
+
+	ASSERT_EQ(3, payloads.size()) << "should invoke the callback for every event";
+	EXPECT_EQ(R"js({"data":{"nextAppointmentChange":{"when":"today","subject":"0"}}})js", payloads[0]) << "should start with a full snapshot";
+	EXPECT_EQ(R"js({"patch":[{"op":"replace","path":"/data/nextAppointmentChange/subject","value":"1"}]})js", payloads[1]) << "should only send the changes";
+	EXPECT_EQ(R"js({"data":{"nextAppointmentChange":{"when":"today","subject":"2"}}})js", payloads[2]) << "should send another full snapshot";
+}
+
 TEST_F(TodayServiceCase, SubscribeNodeChangeMatchingId)
 {
 	auto query = peg::parseString(R"(subscription TestSubscription {
@@ -955,6 +1639,103 @@ TEST_F(TodayServiceCase, SubscribeNodeChangeMismatchedId)
 	}
 }
 
+TEST_F(TodayServiceCase, SubscribeNodeChangeIndexedIds)
+{
+	const std::vector<std::string> ids { "ZmFrZVRhc2tJZA==", "ZmFrZUFwcG9pbnRtZW50SWQ=", "ZmFrZUZvbGRlcklk" };
+	std::vector<service::SubscriptionKey> keys;
+	std::vector<size_t> calledGet(ids.size());
+
+	for (size_t i = 0; i < ids.size(); ++i)
+	{
+		auto query = peg::parseString(R"(subscription TestSubscription($id: ID!) {
+				changedNode: nodeChange(id: $id) {
+					changedId: id
+				}
+			})");
+		response::Value variables(response::Type::Map);
+
+		variables.emplace_back("id", response::Value(std::string(ids[i])));
+		keys.push_back(_service->subscribe(service::SubscriptionParams { nullptr, std::move(query), "TestSubscription", std::move(variables) },
+			[&calledGet, i](std::future<response::Value>)
+		{
+			++calledGet[i];
+		}));
+	}
+
+	bool calledResolver = false;
+	auto subscriptionObject = std::make_shared<today::NodeChange>(
+		[this, &calledResolver](const std::shared_ptr<service::RequestState>&, response::IdType&& idArg) -> std::shared_ptr<service::Object>
+	{
+		calledResolver = true;
+		EXPECT_EQ(_fakeAppointmentId, idArg);
+		return std::static_pointer_cast<service::Object>(std::make_shared<today::Appointment>(response::IdType(_fakeAppointmentId), "tomorrow", "Lunch?", false));
+	});
+
+	_service->deliver("nodeChange", { {"id", response::Value(std::string(ids[1])) } }, std::static_pointer_cast<service::Object>(subscriptionObject));
+	_service->unsubscribe(keys[1]);
+	_service->deliver("nodeChange", { {"id", response::Value(std::string(ids[1])) } }, std::static_pointer_cast<service::Object>(subscriptionObject));
+	_service->unsubscribe(keys[0]);
+	_service->unsubscribe(keys[2]);
+
+	EXPECT_TRUE(calledResolver) << "should resolve the matching subscription";
+	EXPECT_EQ(0, calledGet[0]) << "should skip the subscription to a different id";
+	EXPECT_EQ(1, calledGet[1]) << "should deliver once until it unsubscribes";
+	EXPECT_EQ(0, calledGet[2]) << "should skip the subscription to a different id";
+}
+
+TEST_F(TodayServiceCase, SubscribeNodeChangeFilterKey)
+{
+	const std::vector<std::string> ids { "ZmFrZVRhc2tJZA==", "ZmFrZUFwcG9pbnRtZW50SWQ=", "ZmFrZUZvbGRlcklk" };
+	std::vector<service::SubscriptionKey> keys;
+	std::vector<size_t> calledGet(ids.size());
+	size_t calledFilterKey = 0;
+
+	_service->setSubscriptionFilterKey("nodeChange", [&calledFilterKey](const response::Value& arguments)
+	{
+		++calledFilterKey;
+		return arguments.find("id")->second.get<response::StringType>();
+	});
+
+	for (size_t i = 0; i < ids.size(); ++i)
+	{
+		auto query = peg::parseString(R"(subscription TestSubscription($id: ID!) {
+				changedNode: nodeChange(id: $id) {
+					changedId: id
+				}
+			})");
+		response::Value variables(response::Type::Map);
+
+		variables.emplace_back("id", response::Value(std::string(ids[i])));
+		keys.push_back(_service->subscribe(service::SubscriptionParams { nullptr, std::move(query), "TestSubscription", std::move(variables) },
+			[&calledGet, i](std::future<response::Value>)
+		{
+			++calledGet[i];
+		}));
+	}
+
+	bool calledResolver = false;
+	auto subscriptionObject = std::make_shared<today::NodeChange>(
+		[this, &calledResolver](const std::shared_ptr<service::RequestState>&, response::IdType&& idArg) -> std::shared_ptr<service::Object>
+	{
+		calledResolver = true;
+		EXPECT_EQ(_fakeAppointmentId, idArg);
+		return std::static_pointer_cast<service::Object>(std::make_shared<today::Appointment>(response::IdType(_fakeAppointmentId), "tomorrow", "Lunch?", false));
+	});
+
+	_service->deliver("nodeChange", ids[1], std::static_pointer_cast<service::Object>(subscriptionObject));
+	_service->unsubscribe(keys[1]);
+	_service->deliver("nodeChange", ids[1], std::static_pointer_cast<service::Object>(subscriptionObject));
+	_service->unsubscribe(keys[0]);
+	_service->unsubscribe(keys[2]);
+	_service->setSubscriptionFilterKey("nodeChange", {});
+
+	EXPECT_EQ(ids.size(), calledFilterKey) << "should compute the filter key once per subscription";
+	EXPECT_TRUE(calledResolver) << "should resolve the matching subscription";
+	EXPECT_EQ(0, calledGet[0]) << "should skip the subscription to a different id";
+	EXPECT_EQ(1, calledGet[1]) << "should deliver once until it unsubscribes";
+	EXPECT_EQ(0, calledGet[2]) << "should skip the subscription to a different id";
+}
+
 TEST_F(TodayServiceCase, SubscribeNodeChangeFuzzyComparator)
 {
 	auto query = peg::parseString(R"(subscription TestSubscription {
@@ -1553,3 +2334,272 @@ TEST_F(TodayServiceCase, MutateCoerceSetFloat)
 		FAIL() << response::toJSON(ex.getErrors());
 	}
 }
+
+TEST_F(TodayServiceCase, ValidateMaxSelections)
+{
+	auto query = R"(query {
+			...Fragment3
+		}
+		fragment Fragment3 on Query {
+			...Fragment2
+			...Fragment2
+		}
+		fragment Fragment2 on Query {
+			...Fragment1
+			...Fragment1
+		}
+		fragment Fragment1 on Query {
+			__typename
+		})"_graphql;
+
+	_service->setMaxSelections(10);
+	auto errors = _service->validate(query);
+	_service->setMaxSelections(0);
+
+	ASSERT_EQ(errors.size(), size_t { 1 }) << "should stop validating after the selection limit";
+	EXPECT_EQ(errors.front().message, "Too many selections max: 10");
+	EXPECT_FALSE(query.validated) << "should not mark the query as validated";
+}
+
+TEST_F(TodayServiceCase, ResolveMaxSelections)
+{
+	auto query = R"(query {
+			...Fragment3
+		}
+		fragment Fragment3 on Query {
+			...Fragment2
+			...Fragment2
+		}
+		fragment Fragment2 on Query {
+			...Fragment1
+			...Fragment1
+		}
+		fragment Fragment1 on Query {
+			__typename
+		})"_graphql;
+	response::Value variables(response::Type::Map);
+	auto state = std::make_shared<today::RequestState>(23);
+
+	// Validate without a limit, so the selection limit is only enforced while resolving.
+	ASSERT_TRUE(_service->validate(query).empty());
+
+	_service->setMaxSelections(10);
+	auto result = _service->resolve(state, query, "", std::move(variables)).get();
+	_service->setMaxSelections(0);
+
+	try
+	{
+		ASSERT_TRUE(result.type() == response::Type::Map);
+		const auto& data = result["data"];
+		ASSERT_TRUE(data.type() == response::Type::Null) << "should fail the whole operation";
+		const auto& errors = result["errors"];
+		ASSERT_TRUE(errors.type() == response::Type::List);
+		ASSERT_EQ(errors.size(), size_t { 1 });
+		const auto message = service::StringArgument::require("message", errors[0]);
+		EXPECT_EQ(message, "Too many selections max: 10");
+	}
+	catch (service::schema_exception& ex)
+	{
+		FAIL() << response::toJSON(ex.getErrors());
+	}
+}
+
+TEST_F(TodayServiceCase, ConcurrentSharedQuery)
+{
+	const auto query = R"(query {
+			__schema {
+				types {
+					kind
+					name
+				}
+			}
+		})"_graphql;
+	constexpr size_t threadCount = 8;
+	std::vector<std::future<response::Value>> results;
+
+	results.reserve(threadCount);
+
+	for (size_t i = 0; i < threadCount; ++i)
+	{
+		// Each thread validates and resolves the same const peg::ast.
+		results.push_back(std::async(std::launch::async, [&query, i]() {
+			auto state = std::make_shared<today::RequestState>(24 + i);
+			response::Value variables(response::Type::Map);
+
+			return _service->resolve(std::launch::async, state, query, "", std::move(variables))
+				.get();
+		}));
+	}
+
+	std::vector<response::Value> documents;
+
+	documents.reserve(threadCount);
+
+	for (auto& result : results)
+	{
+		documents.push_back(result.get());
+	}
+
+	EXPECT_TRUE(query.validated) << "should mark the shared query as validated";
+
+	try
+	{
+		const auto& expected = documents.front();
+		ASSERT_TRUE(expected.type() == response::Type::Map);
+		ASSERT_TRUE(expected.find("errors") == expected.end()) << response::toJSON(response::Value(expected));
+
+		for (const auto& document : documents)
+		{
+			EXPECT_TRUE(document == expected) << "should get the same result on every thread";
+		}
+	}
+	catch (service::schema_exception& ex)
+	{
+		FAIL() << response::toJSON(ex.getErrors());
+	}
+}
+
+TEST_F(TodayServiceCase, ResolveCachedQuery)
+{
+	auto query = R"(query {
+			nested {
+				depth
+			}
+		})"_graphql;
+	auto cache = std::make_shared<service::ResponseCache>([](response::Value&& document) {
+		return response::toJSON(std::move(document));
+	});
+	auto state = std::make_shared<today::RequestState>(25);
+
+	today::NestedType::getCapturedParams();
+
+	auto first = _service
+					 ->resolveCached(std::launch::deferred,
+						 state,
+						 query,
+						 "",
+						 response::Value(response::Type::Map),
+						 cache)
+					 .get();
+	auto second = _service
+					  ->resolveCached(std::launch::deferred,
+						  state,
+						  query,
+						  "",
+						  response::Value(response::Type::Map),
+						  cache)
+					  .get();
+
+	ASSERT_TRUE(first != nullptr);
+	EXPECT_EQ(R"js({"data":{"nested":{"depth":1}}})js", *first);
+	EXPECT_EQ(first, second) << "should return the same cached response";
+	EXPECT_EQ(size_t { 1 }, today::NestedType::getCapturedParams().size())
+		<< "should only resolve the query once";
+}
+
+TEST_F(TodayServiceCase, ResolveUncachedQuery)
+{
+	auto query = R"(query {
+			nested {
+				depth
+			}
+			__typename
+		})"_graphql;
+	auto cache = std::make_shared<service::ResponseCache>([](response::Value&& document) {
+		return response::toJSON(std::move(document));
+	});
+	auto state = std::make_shared<today::RequestState>(26);
+
+	today::NestedType::getCapturedParams();
+
+	auto first = _service
+					 ->resolveCached(std::launch::deferred,
+						 state,
+						 query,
+						 "",
+						 response::Value(response::Type::Map),
+						 cache)
+					 .get();
+	auto second = _service
+					  ->resolveCached(std::launch::deferred,
+						  state,
+						  query,
+						  "",
+						  response::Value(response::Type::Map),
+						  cache)
+					  .get();
+
+	ASSERT_TRUE(first != nullptr && second != nullptr);
+	EXPECT_EQ(*first, *second);
+	EXPECT_NE(first, second) << "should not cache a response with an unhinted root field";
+	EXPECT_EQ(size_t { 2 }, today::NestedType::getCapturedParams().size())
+		<< "should resolve the query twice";
+}
+
+TEST_F(TodayServiceCase, EntityCacheInvalidation)
+{
+	auto entityCache = std::make_shared<service::EntityCache>();
+	size_t calledGetTasks = 0;
+	auto query = std::make_shared<today::Query>(
+		[]() -> std::vector<std::shared_ptr<today::Appointment>>
+	{
+		return {};
+	}, [&calledGetTasks]() -> std::vector<std::shared_ptr<today::Task>>
+	{
+		++calledGetTasks;
+		return { std::make_shared<today::Task>(response::IdType(_fakeTaskId), "Don't forget", true) };
+	}, []() -> std::vector<std::shared_ptr<today::Folder>>
+	{
+		return {};
+	}, entityCache);
+	auto mutation = std::make_shared<today::Mutation>(
+		[](today::CompleteTaskInput&& input) -> std::shared_ptr<today::CompleteTaskPayload>
+	{
+		return std::make_shared<today::CompleteTaskPayload>(
+			std::make_shared<today::Task>(std::move(input.id), "Mutated Task!", *(input.isComplete)),
+			std::move(input.clientMutationId)
+			);
+	}, entityCache);
+	auto service = std::make_shared<today::Operations>(query, mutation, std::make_shared<today::Subscription>());
+	auto nodeQuery = R"(query {
+			node(id: "ZmFrZVRhc2tJZA==") {
+				...on Task {
+					title
+				}
+			}
+		})"_graphql;
+	auto completeTask = R"(mutation {
+			completeTask(input: {id: "ZmFrZVRhc2tJZA==", isComplete: false}) {
+				clientMutationId
+			}
+		})"_graphql;
+	auto state = std::make_shared<today::RequestState>(27);
+
+	try
+	{
+		auto result = service->resolve(state, nodeQuery, "", response::Value(response::Type::Map)).get();
+		ASSERT_TRUE(result.type() == response::Type::Map);
+		ASSERT_TRUE(result.find("errors") == result.end()) << response::toJSON(response::Value(result));
+		auto cachedTask = entityCache->find("Task", _fakeTaskId);
+		ASSERT_TRUE(cachedTask != nullptr) << "should cache the Task found by node(id:)";
+
+		result = service->resolve(state, nodeQuery, "", response::Value(response::Type::Map)).get();
+		ASSERT_TRUE(result.find("errors") == result.end()) << response::toJSON(response::Value(result));
+		EXPECT_EQ(cachedTask, entityCache->find("Task", _fakeTaskId)) << "should reuse the cached Task";
+		EXPECT_EQ(size_t(1), calledGetTasks) << "should only call the loader once";
+		EXPECT_EQ(size_t(1), state->loadTasksCount) << "should skip scanning the tasks on a cache hit";
+
+		result = service->resolve(state, completeTask, "", response::Value(response::Type::Map)).get();
+		ASSERT_TRUE(result.find("errors") == result.end()) << response::toJSON(response::Value(result));
+		EXPECT_TRUE(entityCache->find("Task", _fakeTaskId) == nullptr) << "should invalidate the mutated Task";
+
+		result = service->resolve(state, nodeQuery, "", response::Value(response::Type::Map)).get();
+		ASSERT_TRUE(result.find("errors") == result.end()) << response::toJSON(response::Value(result));
+		EXPECT_EQ(size_t(2), state->loadTasksCount) << "should scan the tasks again after invalidating the Task";
+		EXPECT_TRUE(entityCache->find("Task", _fakeTaskId) != nullptr) << "should cache the Task again";
+	}
+	catch (service::schema_exception& ex)
+	{
+		FAIL() << response::toJSON(ex.getErrors());
+	}
+}
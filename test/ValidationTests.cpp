@@ -2017,3 +2017,28 @@ TEST_F(ValidationExamplesCase, Example175)
 
 	ASSERT_TRUE(errors.empty());
 }
+
+TEST_F(ValidationExamplesCase, StopAtMaxErrors)
+{
+	// Same document as http://spec.graphql.org/June2018/#example-12752, which has 2 errors.
+	auto query = R"(query getDogName {
+			dog {
+				name
+				color
+			}
+		}
+
+		extend type Dog {
+			color: String
+		})"_graphql;
+
+	auto errors =
+		service::buildErrorValues(_service->validate(query, 1)).release<response::ListType>();
+
+	ASSERT_EQ(errors.size(), 1) << "should stop after the first error";
+	EXPECT_EQ(
+		R"js({"message":"Undefined field type: Dog name: color","locations":[{"line":4,"column":5}]})js",
+		response::toJSON(std::move(errors[0])))
+		<< "error should match";
+	EXPECT_FALSE(query.validated) << "should not be marked as validated";
+}